@@ -1,8 +1,20 @@
 #include "BRoute.h"
 #include <esphome/core/application.h>
+#include <esphome/core/defines.h>
+#include <esphome/core/helpers.h>
+#ifdef USE_API
+#include <esphome/components/api/api_server.h>
+#endif
+#ifdef USE_ESP32
+#include <esp_heap_caps.h>
+#endif
+#include <algorithm>
+#include <cinttypes>
 #include <cmath>
+#include <cstdio>
 #include <cstring>
 #include "echonet_lite.h"
+#include "profile.h"
 #include "util.h"
 
 namespace esphome::b_route {
@@ -18,472 +30,1904 @@ namespace meter = echonet_lite::props::lowv_smart_meter;
 namespace {
 
 std::array<std::byte, 255> buffer{};
+#ifdef USE_B_ROUTE_POWER
 constexpr std::array PROPS_MOMENTARY_POWER{meter::MOMENTARY_POWER};
+#endif
+#ifdef USE_B_ROUTE_ENERGY
 constexpr std::array PROPS_ENERGY_PARAMS{meter::ENERGY_COEFF, meter::ENERGY_UNIT};
 constexpr std::array PROPS_INTEGRAL_ENERGY{meter::INTEGRAL_ENERGY_FWD};
+constexpr std::array PROPS_METER_CLOCK{meter::CURRENT_DATE, meter::CURRENT_TIME};
+#endif
+constexpr std::array PROPS_PROPERTY_MAP{meter::GET_PROPERTY_MAP};
+constexpr std::array PROPS_INSTANCE_LIST{echo::props::node_profile::SELF_NODE_INSTANCE_LIST};
 
-constexpr uint32_t SEND_RETRY_INTERVAL = 2'000;
-constexpr uint32_t REQUEST_RETRY_INTERVAL = 5'000;
 constexpr uint32_t RESTART_DELAY = 5'000;
+constexpr uint32_t MODULE_RESET_DELAY = 3'000;
+constexpr uint8_t MODULE_HARD_FAULT_COUNT = 3;
+constexpr uint32_t RECOVERY_BACKOFF_MAX = 1'800'000;
+constexpr uint8_t MAX_SEND_RETRIES = 3;
 
-constexpr const char* power_task = "power";
-constexpr const char* energy_task = "energy";
-constexpr const char* params_task = "params";
+// Get request queue
+constexpr uint32_t RESPONSE_TIMEOUT = 5'000;
+constexpr uint32_t REQUEST_GAP = 1'000;
+constexpr uint8_t MAX_REQUEST_ATTEMPTS = 3;
+#ifdef USE_B_ROUTE_POWER
+constexpr uint8_t PRIORITY_POWER = 1;
+constexpr uint8_t PRIORITY_BURST = 3;
+#endif
+#ifdef USE_B_ROUTE_PROPERTIES
+constexpr uint8_t PRIORITY_PROPERTIES = 1;
+#endif
+#ifdef USE_B_ROUTE_ENERGY
+constexpr uint8_t PRIORITY_ENERGY = 2;
+constexpr uint8_t PRIORITY_CLOCK = 2;
+constexpr uint8_t PRIORITY_PARAMS = 3;
+#endif
+constexpr uint8_t PRIORITY_PROPERTY_MAP = 4;
+constexpr uint8_t PRIORITY_DISCOVERY = 5;
+constexpr uint8_t PRIORITY_CACHE = 2;
+// property_cache consumers waiting for a refresh
+constexpr uint32_t CACHE_WAIT_TIMEOUT = 30'000;
+constexpr uint32_t CACHE_EXPIRE_CHECK = 1'000;
 
-constexpr std::string_view SCAN_KEY_ADDR = "Addr:";
-constexpr std::string_view SCAN_KEY_PANID = "Pan ID:";
-constexpr std::string_view SCAN_KEY_CHANNEL = "Channel:";
+// burst sampling of momentary power
+constexpr uint32_t BURST_REQUEST_GAP = 200;
+#ifdef USE_B_ROUTE_POWER
+constexpr uint32_t BURST_MIN_INTERVAL = 500;
+constexpr uint32_t BURST_MAX_DURATION = 600'000;
+#endif
+
+constexpr const char* REQUEST_TIMER = "request";
+#ifdef USE_B_ROUTE_ENERGY
+constexpr const char* ENERGY_TIMER = "energy";
+constexpr const char* CLOCK_TIMER = "clock";
+#endif
+#ifdef USE_B_ROUTE_POWER
+constexpr const char* POWER_TIMER = "power";
+#endif
+constexpr const char* BURST_TIMER = "burst";
+constexpr const char* CACHE_TIMER = "cache";
+constexpr const char* STATE_TIMER = "state";
+constexpr const char* RECOVERY_TIMER = "recovery";
+constexpr const char* REAUTH_TIMER = "reauth";
+constexpr const char* REAUTH_DEADLINE_TIMER = "reauth_deadline";
+
+// PANA session lifetime (S16) default
+constexpr uint32_t DEFAULT_SESSION_LIFETIME = 7'200'000;
+constexpr uint32_t REAUTH_MARGIN_MIN = 60'000;
+constexpr uint32_t REAUTH_MARGIN_MAX = 600'000;
+
+#ifdef USE_B_ROUTE_ENERGY
+// meter clock reads, not a multiple of a minute so that readings sample different phases of the minute
+constexpr uint32_t CLOCK_SYNC_INTERVAL = 3'613'000;
+constexpr uint32_t CLOCK_SYNC_FAST_INTERVAL = 307'000;
+constexpr uint32_t CLOCK_SYNC_PRECISION = 10'000;
+constexpr uint32_t CLOCK_RESOLUTION = 60'000;
+// energy reads aligned to the 30 min slots of the meter
+constexpr uint32_t ENERGY_SLOT = 1'800'000;
+constexpr uint32_t ENERGY_SLOT_DELAY = 15'000;
+constexpr uint32_t ENERGY_SLOT_MAX_AGE = 300'000;
+#endif
+
+constexpr uint32_t PAN_BLACKLIST_COOLDOWN = 600'000;
+constexpr uint32_t LINK_QUALITY_INTERVAL = 60'000;
+constexpr uint32_t LINK_ACTION_COOLDOWN = 120'000;
+constexpr uint32_t LINK_ESCALATE_WINDOW = 600'000;
+constexpr uint32_t UART_STATS_INTERVAL = 600'000;
+// lines handled in one loop(), the rest stays in the UART buffer
+constexpr int MAX_LINES_PER_LOOP = 8;
+
+// Rohm BP35 LQI to RSSI(dBm) conversion
+float
+lqi_to_rssi(uint8_t lqi) {
+	return 0.275f * lqi - 104.27f;
+}
+
+// every EPC of `epcs` is in `set`
+bool
+contains_all(const uint8_t* set, size_t set_count, const uint8_t* epcs, size_t count) {
+	return std::all_of(epcs, epcs + count, [=](uint8_t epc) { return std::find(set, set + set_count, epc) != set + set_count; });
+}
+
+// fnv1_hash(prefix + MAC) without building the string, keeps the keys of saved preferences
+uint32_t
+meter_pref_key(std::string_view prefix, const uint8_t (&addr)[8]) {
+	uint32_t hash = 2166136261UL;
+	auto add = [&hash](std::string_view s) {
+		for (char c : s) {
+			hash *= 16777619UL;
+			hash ^= static_cast<uint8_t>(c);
+		}
+	};
+	add(prefix);
+	add(arg::mac(addr));
+	return hash;
+}
 
 }  // namespace
 
 BRoute::BRoute() {}
 
 void
-BRoute::request_energy_parameters() {
-	auto rc = request_property(PROPS_ENERGY_PARAMS);
-	if (rc) {
-		ESP_LOGD(TAG, "Energy params requested");
+BRoute::enqueue_request(const uint8_t* props, size_t count, uint8_t priority, uint32_t max_age, bool node_profile) {
+	std::array<uint8_t, echonet_lite::MAX_PROPERTIES> supported;
+	std::copy(props, props + count, std::begin(supported));
+	if (!node_profile) {
+		count = filter_supported(supported.data(), count);
+	}
+	if (count == 0) {
+		return;
+	}
+	props = supported.data();
+	auto now = esphome::millis();
+	request_t* slot = nullptr;
+	for (auto& r : request_queue) {
+		if (!r.used || r.node_profile != node_profile) {
+			continue;
+		}
+		// coalesce with a pending request asking for all of these, the response serves both;
+		// one not sent yet grows into a request for more of its properties
+		bool covered = contains_all(r.epcs.data(), r.count, props, count);
+		bool widened = !covered && &r != inflight && contains_all(props, count, r.epcs.data(), r.count);
+		if (covered || widened) {
+			if (widened) {
+				std::copy(props, props + count, std::begin(r.epcs));
+				r.count = count;
+			}
+			if (&r != inflight) {
+				r.enqueued = now;
+				r.attempts = 0;
+			}
+			r.priority = std::max(r.priority, priority);
+			// keep the stricter freshness limit, 0 never expires
+			if (max_age && (r.max_age == 0 || max_age < r.max_age)) {
+				r.max_age = max_age;
+			}
+			return;
+		}
+	}
+	for (auto& r : request_queue) {
+		if (!r.used) {
+			slot = &r;
+			break;
+		}
+	}
+	if (slot == nullptr) {
+		// queue full, evict the oldest request of the lowest priority
+		for (auto& r : request_queue) {
+			if (&r == inflight) {
+				continue;
+			}
+			if (slot == nullptr || r.priority < slot->priority ||
+			    (r.priority == slot->priority && now - r.enqueued > now - slot->enqueued)) {
+				slot = &r;
+			}
+		}
+		if (slot == nullptr || slot->priority > priority) {
+			ESP_LOGW(TAG, "Request queue full, drop request %02X", props[0]);
+			requests_dropped++;
+			return;
+		}
+		ESP_LOGW(TAG, "Request queue full, drop request %02X", slot->epcs[0]);
+		requests_dropped++;
+	}
+	std::copy(props, props + count, std::begin(slot->epcs));
+	slot->count = count;
+	slot->priority = priority;
+	slot->attempts = 0;
+	slot->enqueued = now;
+	slot->max_age = max_age;
+	slot->node_profile = node_profile;
+	slot->used = true;
+	pump_requests();
+}
+
+size_t
+BRoute::filter_supported(uint8_t* epcs, size_t count) const {
+	auto end = std::remove_if(epcs, epcs + count, [this](uint8_t epc) { return !property_supported(epc); });
+	return end - epcs;
+}
+
+void
+BRoute::pump_requests() {
+	if (state != state_t::running) {
+		return;
+	}
+	auto now = esphome::millis();
+	if (awaiting_response) {
+		auto elapsed = now - property_requested;
+		if (elapsed < RESPONSE_TIMEOUT) {
+			set_timeout(REQUEST_TIMER, RESPONSE_TIMEOUT - elapsed, [this] { pump_requests(); });
+			return;
+		}
+		ESP_LOGD(TAG, "No response to tid=%u", inflight_tid);
+		record_trace(trace::kind_t::timeout, inflight ? inflight->epcs[0] : 0, inflight ? inflight->attempts : 0,
+		             inflight_tid);
+		no_responses++;
+		if (inflight && inflight->attempts >= MAX_REQUEST_ATTEMPTS) {
+			drop_inflight();
+		}
+		awaiting_response = false;
+		inflight = nullptr;
+		request_done = now;
+		record_link_result(false);
+		if (state != state_t::running) {
+			return;
+		}
+	}
+	if (reauth_pending) {
+		start_reauth();
+		return;
+	}
+	if (rejoin_miss_count && miss_count >= rejoin_miss_count) {
+		ESP_LOGW(TAG, "Data not received for %u times, rejoin to meter", miss_count);
+		miss_count = 0;
+		perform_recovery(recovery::action_t::rejoin);
+		return;
+	}
+	auto gap = burst_active ? BURST_REQUEST_GAP : REQUEST_GAP;
+	if (request_done && now - request_done < gap) {
+		set_timeout(REQUEST_TIMER, gap - (now - request_done), [this] { pump_requests(); });
+		return;
+	}
+	request_t* next = nullptr;
+	for (auto& r : request_queue) {
+		if (!r.used) {
+			continue;
+		}
+		if (r.max_age && now - r.enqueued >= r.max_age) {
+			ESP_LOGD(TAG, "Drop stale request %02X (%lu ms old)", r.epcs[0], now - r.enqueued);
+			r.used = false;
+			requests_dropped++;
+			continue;
+		}
+		if (next == nullptr || r.priority > next->priority ||
+		    (r.priority == next->priority && now - r.enqueued > now - next->enqueued)) {
+			next = &r;
+		}
+	}
+	if (next == nullptr) {
+		return;
+	}
+	auto tid = ++next_tid;
+	if (!send_property_get(next->epcs.data(), next->count, tid, next->node_profile)) {
+		next->used = false;
+		return;
+	}
+	ESP_LOGD(TAG, "Get %02X (opc=%u, tid=%u, priority=%u, attempt=%u)", next->epcs[0], next->count, tid, next->priority,
+	         next->attempts + 1);
+	inflight = next;
+	inflight->attempts++;
+	inflight_tid = tid;
+	send_retries = 0;
+	property_requested = now;
+	awaiting_response = true;
+	++miss_count;
+	set_timeout(REQUEST_TIMER, RESPONSE_TIMEOUT, [this] { pump_requests(); });
+}
+
+void
+BRoute::complete_request() {
+	drop_inflight();
+	awaiting_response = false;
+	request_done = std::max<uint32_t>(esphome::millis(), 1);
+	record_link_result(true);
+	pump_requests();
+}
+
+void
+BRoute::drop_inflight() {
+	if (inflight) {
+		inflight->used = false;
+		inflight = nullptr;
+	}
+}
+
+bool
+BRoute::send_property_get(const uint8_t* props, size_t count, uint16_t tid, bool node_profile) {
+	size_t len = echo::Codec::encode_property_get(out_buffer, tid, EOJ_CONTROLLER, node_profile ? EOJ_NODE_PROFILE : meter_eoj,
+	                                              props, props + count);
+	if (len > std::size(out_buffer)) {
+		ESP_LOGE(TAG, "Get property encode overflow");
+		return false;
+	}
+	bp.send_sk_with_data("SKSENDTO", out_buffer.data(), len, arg::mode(1), arg::ipv6(v6_address), arg::num16(echo::UDP_PORT),
+	                     arg::mode(2), arg::num16(len));
+	record_trace(trace::kind_t::tx, props[0], count, tid);
+	return true;
+}
+
+void
+BRoute::resend_inflight() {
+	if (!awaiting_response || inflight == nullptr) {
+		return;
+	}
+	ESP_LOGD(TAG, "Replay request tid=%u", inflight_tid);
+	if (send_property_get(inflight->epcs.data(), inflight->count, inflight_tid, inflight->node_profile)) {
+		property_requested = esphome::millis();
+		set_timeout(REQUEST_TIMER, RESPONSE_TIMEOUT, [this] { pump_requests(); });
+	}
+}
+
+#ifdef USE_B_ROUTE_ENERGY
+void
+BRoute::request_energy_parameters() {
+	enqueue_request(PROPS_ENERGY_PARAMS, PRIORITY_PARAMS, 0);
+}
+#endif
+
+#ifdef USE_B_ROUTE_POWER
+void
+BRoute::request_momentary_power() {
+	enqueue_request(PROPS_MOMENTARY_POWER, PRIORITY_POWER, power_sensor_interval);
+}
+#endif
+
+void
+BRoute::start_burst(uint32_t duration, uint32_t interval) {
+#ifndef USE_B_ROUTE_POWER
+	(void) duration;
+	(void) interval;
+	ESP_LOGW(TAG, "Burst requires the power sensor");
+#else
+	if (!power_sensor) {
+		ESP_LOGW(TAG, "Burst requires the power sensor");
+		return;
+	}
+	if (duration == 0) {
+		stop_burst();
+		return;
+	}
+	if (tx_limited) {
+		ESP_LOGW(TAG, "Burst ignored, transmit time limit active");
+		return;
+	}
+	duration = std::min(duration, BURST_MAX_DURATION);
+	interval = std::max(interval, BURST_MIN_INTERVAL);
+	ESP_LOGI(TAG, "Burst power sampling every %lu ms for %lu s", interval, duration / 1000);
+	burst_active = true;
+	set_interval(POWER_TIMER, interval, [this, interval] {
+		enqueue_request(PROPS_MOMENTARY_POWER, PRIORITY_BURST, interval);
+	});
+	set_timeout(BURST_TIMER, duration, [this] { stop_burst(); });
+	enqueue_request(PROPS_MOMENTARY_POWER, PRIORITY_BURST, interval);
+#endif
+}
+
+void
+BRoute::stop_burst() {
+	if (!burst_active) {
+		return;
+	}
+	ESP_LOGI(TAG, "Burst power sampling finished");
+	burst_active = false;
+	cancel_timeout(BURST_TIMER);
+#ifdef USE_B_ROUTE_POWER
+	if (power_sensor_interval) {
+		set_interval(POWER_TIMER, power_sensor_interval, [this] { request_momentary_power(); });
+	} else {
+		cancel_interval(POWER_TIMER);
+	}
+#endif
+}
+
+#ifdef USE_B_ROUTE_ENERGY
+void
+BRoute::request_integral_energy() {
+	if (!energy_params_received()) {
+		request_energy_parameters();
+		return;
+	}
+	enqueue_request(PROPS_INTEGRAL_ENERGY, PRIORITY_ENERGY,
+	                energy_slot_aligned && meter_time.valid() ? ENERGY_SLOT_MAX_AGE : energy_sensor_interval);
+}
+
+void
+BRoute::schedule_energy() {
+	uint32_t delay = energy_sensor_interval;
+	if (energy_slot_aligned && meter_time.valid()) {
+		// read once per slot, after the boundary even if the clock estimate is early
+		delay = meter_time.until_boundary(esphome::millis(), ENERGY_SLOT, ENERGY_SLOT_DELAY + meter_time.uncertainty() / 2);
+	}
+	set_timeout(ENERGY_TIMER, delay, [this] {
+		request_integral_energy();
+		schedule_energy();
+	});
+}
+#endif
+
+#ifdef USE_B_ROUTE_PROPERTIES
+void
+BRoute::request_properties(size_t begin, size_t end) {
+	std::array<uint8_t, echonet_lite::MAX_PROPERTIES> epcs;
+	size_t n = 0;
+	for (auto i = begin; i < end && n < epcs.size(); i++) {
+		epcs[n++] = properties[i].epc;
+	}
+	enqueue_request(epcs.data(), n, PRIORITY_PROPERTIES, properties[begin].interval);
+}
+
+bool
+BRoute::handle_custom_property(const std::byte* raw, const echo::Property& prop) {
+	for (size_t i = 0; i < property_count; i++) {
+		auto& def = properties[i];
+		if (def.epc != prop.epc) {
+			continue;
+		}
+		if (prop.pdc != def.size) {
+			ESP_LOGW(TAG, "Property(%02X) len mismatch %u != %u", prop.epc, prop.pdc, def.size);
+			return true;
+		}
+		uint32_t v = 0;
+		for (size_t k = 0; k < def.size; k++) {
+			v = (v << 8) | std::to_integer<uint8_t>(raw[prop.offset + k]);
+		}
+		if (def.is_signed) {
+			auto shift = 32 - 8 * def.size;
+			v = static_cast<uint32_t>(static_cast<int32_t>(v << shift) >> shift);
+		}
+		ESP_LOGD(TAG, "Property %02X received", prop.epc);
+		reset_timers();
+		miss_count = 0;
+		publish_reading(CHANNEL_PROPERTIES + i, v);
+		return true;
+	}
+	return false;
+}
+#endif
+
+#ifdef USE_B_ROUTE_ENERGY
+void
+BRoute::request_meter_clock() {
+	enqueue_request(PROPS_METER_CLOCK, PRIORITY_CLOCK, CLOCK_SYNC_FAST_INTERVAL);
+	auto precise = meter_time.valid() && meter_time.uncertainty() <= CLOCK_SYNC_PRECISION;
+	set_timeout(CLOCK_TIMER, precise ? CLOCK_SYNC_INTERVAL : CLOCK_SYNC_FAST_INTERVAL, [this] { request_meter_clock(); });
+}
+
+void
+BRoute::handle_meter_clock(const meter_clock::datetime_t& dt) {
+	if (dt.hour == 0 && dt.min == 0) {
+		// date may have been read before midnight
+		return;
+	}
+	auto was_valid = meter_time.valid();
+	if (!meter_time.sync(property_requested, esphome::millis(), meter_clock::to_epoch_ms(dt), CLOCK_RESOLUTION)) {
+		ESP_LOGW(TAG, "Meter clock jumped, re-synchronized");
+	}
+	ESP_LOGD(TAG, "Meter clock %04u-%02u-%02u %02u:%02u (uncertainty %lu ms, drift %.1f ppm)", dt.year, dt.mon, dt.day,
+	         dt.hour, dt.min, meter_time.uncertainty(), meter_time.drift_ppm());
+	if (!was_valid && energy_slot_aligned && energy_sensor && energy_sensor_interval) {
+		// switch from the fixed interval to slot aligned reads
+		schedule_energy();
+	}
+}
+#endif
+
+const property_cache::entry_t*
+BRoute::get(uint8_t epc, uint32_t max_age, property_cache::callback_t callback) {
+	auto now = esphome::millis();
+	auto* entry = value_cache.find(epc);
+	if (entry && entry->age(now) <= max_age) {
+		return entry;
+	}
+	if (!property_supported(epc)) {
+		if (callback) {
+			callback(nullptr);
+		}
+		return nullptr;
+	}
+	if (callback) {
+		if (!value_cache.wait(epc, now + CACHE_WAIT_TIMEOUT, std::move(callback))) {
+			ESP_LOGW(TAG, "Too many waiting reads, %02X not notified", epc);
+		} else if (!cache_timer_armed) {
+			cache_timer_armed = true;
+			set_timeout(CACHE_TIMER, CACHE_EXPIRE_CHECK, [this] { expire_cache_waiters(); });
+		}
+	}
+	// coalesced with a pending request of the same EPC, including the periodic ones
+	enqueue_request(&epc, 1, PRIORITY_CACHE, CACHE_WAIT_TIMEOUT);
+	return nullptr;
+}
+
+void
+BRoute::expire_cache_waiters() {
+	cache_timer_armed = value_cache.expire(esphome::millis());
+	if (cache_timer_armed) {
+		set_timeout(CACHE_TIMER, CACHE_EXPIRE_CHECK, [this] { expire_cache_waiters(); });
+	}
+}
+
+void
+BRoute::update_cache(const std::byte* raw, const echo::Packet& pkt) {
+	auto now = esphome::millis();
+	for (int i = 0; i < pkt.opc; i++) {
+		auto& prop = pkt.properties[i];
+		const property_cache::entry_t* entry = nullptr;
+		if (prop.pdc > 0) {
+			entry = value_cache.store(prop.epc, reinterpret_cast<const uint8_t*>(raw + prop.offset), prop.pdc, pkt.tid, now);
+		}
+		value_cache.resolve(prop.epc, entry);
+	}
+}
+
+void
+BRoute::load_meter_eoj() {
+	auto key = meter_pref_key("b_route_meter_eoj_", pan_selected.addr);
+	if (meter_eoj_known && key == meter_eoj_key) {
+		return;
+	}
+	meter_eoj = EOJ_LOWV_SMART_METER;
+	meter_eoj_known = false;
+	meter_eoj_key = key;
+	meter_eoj_pref = global_preferences->make_preference<EOJ>(key, true);
+	EOJ eoj;
+	if (meter_eoj_pref.load(&eoj) && eoj.X1 == EOJ_LOWV_SMART_METER.X1 && eoj.X2 == EOJ_LOWV_SMART_METER.X2) {
+		meter_eoj = eoj;
+		meter_eoj_known = true;
+		ESP_LOGD(TAG, "Meter instance %02X%02X%02X loaded", eoj.X1, eoj.X2, eoj.X3);
+		return;
+	}
+	enqueue_request(PROPS_INSTANCE_LIST, PRIORITY_DISCOVERY, 0, true);
+}
+
+void
+BRoute::handle_node_profile(const std::byte* raw, const echo::Packet& pkt) {
+	for (int i = 0; i < pkt.opc; i++) {
+		auto& prop = pkt.properties[i];
+		if (prop.epc != echo::props::node_profile::SELF_NODE_INSTANCE_LIST &&
+		    prop.epc != echo::props::node_profile::INSTANCE_LIST_NOTIFICATION) {
+			continue;
+		}
+		EOJ eoj;
+		if (!echo::Codec::find_instance(raw + prop.offset, prop.pdc, EOJ_LOWV_SMART_METER.X1, EOJ_LOWV_SMART_METER.X2, eoj)) {
+			ESP_LOGW(TAG, "No smart meter in instance list (%02X), using %02X%02X%02X", prop.epc, meter_eoj.X1, meter_eoj.X2,
+			         meter_eoj.X3);
+			continue;
+		}
+		if (meter_eoj_known && eoj.X3 == meter_eoj.X3) {
+			continue;
+		}
+		ESP_LOGI(TAG, "Meter instance %02X%02X%02X", eoj.X1, eoj.X2, eoj.X3);
+		meter_eoj = eoj;
+		meter_eoj_known = true;
+		meter_eoj_pref.save(&meter_eoj);
+	}
+}
+
+void
+BRoute::load_property_map() {
+	auto key = meter_pref_key("b_route_property_map_", pan_selected.addr);
+	if (property_map_known && key == property_map_key) {
+		return;
+	}
+	property_map_known = false;
+	property_map_key = key;
+	property_map_pref = global_preferences->make_preference<echo::PropertyMap>(key, true);
+	if (property_map_pref.load(&property_map)) {
+		ESP_LOGD(TAG, "Property map of %s loaded", arg::mac(pan_selected.addr).c_str());
+		property_map_known = true;
+		apply_property_map();
+		return;
+	}
+	enqueue_request(PROPS_PROPERTY_MAP, PRIORITY_PROPERTY_MAP, 0);
+}
+
+void
+BRoute::apply_property_map() {
+	ESP_LOGI(TAG, "Meter supports %u Get properties", property_map.count());
+#ifdef USE_B_ROUTE_POWER
+	if (power_sensor && !property_map.has(meter::MOMENTARY_POWER)) {
+		ESP_LOGW(TAG, "Meter does not support momentary power (E7), power sensor disabled");
+	}
+#endif
+#ifdef USE_B_ROUTE_ENERGY
+	if (energy_sensor && !(property_map.has(meter::INTEGRAL_ENERGY_FWD) && property_map.has(meter::ENERGY_UNIT))) {
+		ESP_LOGW(TAG, "Meter does not support integral energy (E0/E1), energy sensor disabled");
+	}
+	if (!property_map.has(meter::ENERGY_COEFF) && !energy_scale.has_coefficient()) {
+		// coefficient is optional, 1 if not present
+		energy_scale.set_coefficient(1);
+		apply_energy_scale();
+	}
+	if (!(property_map.has(meter::CURRENT_DATE) && property_map.has(meter::CURRENT_TIME))) {
+		ESP_LOGW(TAG, "Meter does not support current date/time (97/98), clock sync disabled");
+	}
+#endif
+#ifdef USE_B_ROUTE_PROPERTIES
+	for (size_t i = 0; i < property_count; i++) {
+		if (!property_map.has(properties[i].epc)) {
+			ESP_LOGW(TAG, "Meter does not support property %02X, sensor disabled", properties[i].epc);
+		}
+	}
+#endif
+	for (auto& r : request_queue) {
+		if (!r.used || &r == inflight) {
+			continue;
+		}
+		r.count = filter_supported(r.epcs.data(), r.count);
+		r.used = r.count > 0;
+	}
+}
+
+bool
+BRoute::api_connected() const {
+#ifdef USE_API
+	return api::global_api_server == nullptr || api::global_api_server->is_connected();
+#else
+	return true;
+#endif
+}
+
+float
+BRoute::reading_value(uint8_t channel, uint32_t raw) const {
+	switch (channel) {
+#ifdef USE_B_ROUTE_POWER
+		case CHANNEL_POWER:
+			return static_cast<int32_t>(raw);
+#endif
+#ifdef USE_B_ROUTE_ENERGY
+		case CHANNEL_ENERGY:
+			return energy_scale.to_kwh(raw);
+#endif
+		default:
+#ifdef USE_B_ROUTE_PROPERTIES
+			auto& def = properties[channel - CHANNEL_PROPERTIES];
+			return (def.is_signed ? static_cast<float>(static_cast<int32_t>(raw)) : static_cast<float>(raw)) * def.scale;
+#else
+			(void) raw;
+			return NAN;
+#endif
+	}
+}
+
+sensor::Sensor*
+BRoute::reading_sensor(uint8_t channel) const {
+	switch (channel) {
+#ifdef USE_B_ROUTE_POWER
+		case CHANNEL_POWER:
+			return power_sensor;
+#endif
+#ifdef USE_B_ROUTE_ENERGY
+		case CHANNEL_ENERGY:
+			return energy_sensor;
+#endif
+		default:
+#ifdef USE_B_ROUTE_PROPERTIES
+			return channel >= CHANNEL_PROPERTIES && static_cast<size_t>(channel - CHANNEL_PROPERTIES) < property_count
+			           ? property_sensors[channel - CHANNEL_PROPERTIES]
+			           : nullptr;
+#else
+			return nullptr;
+#endif
+	}
+}
+
+void
+BRoute::publish_reading(uint8_t channel, uint32_t raw) {
+	auto* sensor = reading_sensor(channel);
+	if (sensor == nullptr) {
+		return;
+	}
+	// automations, filters and lambdas on the device always get the reading as it arrives
+	sensor->publish_state(reading_value(channel, raw));
+	if (offline_readings.enabled() && !api_connected()) {
+		if (!offline_buffering) {
+			ESP_LOGW(TAG, "API disconnected, buffering readings");
+			offline_buffering = true;
+		}
+		offline_readings.push({channel, esphome::millis(), raw});
+	}
+}
+
+void
+BRoute::flush_offline_readings() {
+	if (offline_readings.empty() || !api_connected()) {
+		return;
+	}
+	if (offline_buffering) {
+		ESP_LOGI(TAG, "API connected, replay %u readings (%u bytes, %u dropped)", offline_readings.size(),
+		         offline_readings.bytes_used(), offline_readings.dropped());
+		offline_buffering = false;
+	}
+	offline::reading_t r;
+	if (!offline_readings.pop(r)) {
+		return;
+	}
+	auto age = (esphome::millis() - r.time) / 1000;
+	ESP_LOGV(TAG, "Replay reading %u of %lu s ago", r.channel, age);
+	if (auto* sensor = reading_sensor(r.channel)) {
+		// the sensor already holds a newer state, hand the reading over with its age instead of republishing it
+		replay_callback.call(sensor->get_name().c_str(), reading_value(r.channel, r.value), age);
+	}
+}
+
+#ifdef USE_B_ROUTE_ENERGY
+void
+BRoute::apply_energy_scale() {
+	if (!energy_scale.ready()) {
+		return;
+	}
+	ESP_LOGD(TAG, "Energy scale %u * 10^%d kWh", energy_scale.multiplier(), energy_scale.exponent());
+	if (energy_sensor) {
+		energy_sensor->set_accuracy_decimals(energy_scale.decimals());
+	}
+}
+#endif
+
+#ifdef USE_B_ROUTE_POWER_STATS
+void
+BRoute::publish_power_stats() {
+	if (power_stats.count() == 0) {
+		return;
+	}
+	ESP_LOGD(TAG, "Power stats: n=%u, min=%.0f, max=%.0f, mean=%.1f, p95=%.0f", power_stats.count(), power_stats.min(),
+	         power_stats.max(), power_stats.mean(), power_stats.p95());
+	if (power_min_sensor) {
+		power_min_sensor->publish_state(power_stats.min());
+	}
+	if (power_max_sensor) {
+		power_max_sensor->publish_state(power_stats.max());
+	}
+	if (power_mean_sensor) {
+		power_mean_sensor->publish_state(power_stats.mean());
+	}
+	if (power_p95_sensor) {
+		power_p95_sensor->publish_state(power_stats.p95());
+	}
+	power_stats.reset();
+}
+#endif
+
+void
+BRoute::record_link_result(bool success) {
+	link_success_fast.add(success ? 1.0f : 0.0f);
+	link_success_slow.add(success ? 1.0f : 0.0f);
+	if (!success) {
+		check_link_quality();
+	}
+}
+
+float
+BRoute::link_quality(const stats::Ewma& success) const {
+	if (!success.valid()) {
+		return NAN;
+	}
+	float q = success.value() * 100;
+	if (link_rssi.valid()) {
+		// -100dBm..-60dBm maps to 0..100%
+		float signal = std::clamp((link_rssi.value() + 100.0f) * 100 / 40, 0.0f, 100.0f);
+		q = (q + signal) / 2;
+	}
+	return q;
+}
+
+void
+BRoute::check_link_quality() {
+	if (link_quality_threshold <= 0 || state != state_t::running) {
+		return;
+	}
+	auto fast = link_quality(link_success_fast);
+	auto slow = link_quality(link_success_slow);
+	// act only while quality is low and still trending down
+	if (std::isnan(fast) || fast >= link_quality_threshold || fast >= slow) {
+		return;
+	}
+	auto now = esphome::millis();
+	if (last_link_action && now - last_link_action < LINK_ACTION_COOLDOWN) {
+		return;
+	}
+	bool escalate = last_link_action && now - last_link_action < LINK_ESCALATE_WINDOW;
+	last_link_action = now;
+	link_success_fast.reset(link_success_slow.value());
+	if (escalate) {
+		ESP_LOGW(TAG, "Link quality %.0f%% (avg %.0f%%) still degrading, rescan", fast, slow);
+		perform_recovery(recovery::action_t::rescan);
+	} else {
+		ESP_LOGW(TAG, "Link quality %.0f%% (avg %.0f%%) degrading, rejoin", fast, slow);
+		perform_recovery(recovery::action_t::rejoin);
+	}
+}
+
+#ifdef USE_B_ROUTE_DEMAND
+void
+BRoute::update_demand() {
+	auto predicted = demand_tracker.predict(meter_time.now(esphome::millis()));
+	if (std::isnan(predicted)) {
+		return;
+	}
+	demand_sensor->publish_state(predicted);
+	if (demand_threshold > 0 && predicted >= demand_threshold && demand_tracker.slot() != demand_alerted_slot) {
+		demand_alerted_slot = demand_tracker.slot();
+		ESP_LOGW(TAG, "Demand of this slot predicted %.2f kW, threshold %.2f kW", predicted, demand_threshold);
+		demand_threshold_callback.call(predicted);
+	}
+}
+#endif
+
+void
+BRoute::publish_link_quality() {
+	auto q = link_quality(link_success_slow);
+	if (std::isnan(q)) {
+		return;
+	}
+	ESP_LOGD(TAG, "Link quality %.0f%% (rssi=%.0f, success=%.2f/%.2f)", q, link_rssi.value(), link_success_fast.value(),
+	         link_success_slow.value());
+	link_quality_sensor->publish_state(q);
+}
+
+void
+BRoute::commit_pan() {
+	auto pan = pan_parsing;
+	pan_parsing = {};
+	if (!pan.complete()) {
+		return;
+	}
+	if (!(pan.fields & libbp35::pandesc_t::HAS_LQI)) {
+		pan.lqi = 0;
+	}
+	ESP_LOGD(TAG, "PAN: addr=%s, panid=%04X, channel=%02X, lqi=%u", arg::mac(pan.addr).c_str(), pan.panid, pan.channel,
+	         pan.lqi);
+	for (size_t i = 0; i < pan_count; i++) {
+		if (std::equal(std::begin(pan.addr), std::end(pan.addr), std::begin(pans[i].addr))) {
+			if (pan.lqi > pans[i].lqi) {
+				pans[i] = pan;
+			}
+			return;
+		}
+	}
+	if (pan_count < std::size(pans)) {
+		pans[pan_count++] = pan;
+		return;
+	}
+	// table full, replace the weakest one
+	auto weakest = std::min_element(std::begin(pans), std::end(pans), [](auto& a, auto& b) { return a.lqi < b.lqi; });
+	if (weakest->lqi < pan.lqi) {
+		*weakest = pan;
+	}
+}
+
+bool
+BRoute::select_pan() {
+	const libbp35::pandesc_t* best = nullptr;
+	const libbp35::pandesc_t* best_blacklisted = nullptr;
+	for (size_t i = 0; i < pan_count; i++) {
+		auto& pan = pans[i];
+		if (meter_mac_set && !std::equal(std::begin(pan.addr), std::end(pan.addr), std::begin(meter_mac))) {
+			continue;
+		}
+		auto& b = is_pan_blacklisted(pan.addr) ? best_blacklisted : best;
+		if (b == nullptr || pan.lqi > b->lqi) {
+			b = &pan;
+		}
+	}
+	if (best == nullptr && best_blacklisted != nullptr) {
+		ESP_LOGW(TAG, "All PANs are blacklisted, try the strongest one");
+		best = best_blacklisted;
+	}
+	if (best == nullptr) {
+		return false;
+	}
+	pan_selected = *best;
+	if (pan_selected.fields & libbp35::pandesc_t::HAS_LQI) {
+		link_rssi.reset(lqi_to_rssi(pan_selected.lqi));
+	}
+	ESP_LOGI(TAG, "Selected PAN: addr=%s, panid=%04X, channel=%02X, lqi=%u (%u found)", arg::mac(pan_selected.addr).c_str(),
+	         pan_selected.panid, pan_selected.channel, pan_selected.lqi, pan_count);
+	return true;
+}
+
+void
+BRoute::blacklist_pan(const uint8_t (&addr)[8]) {
+	auto now = esphome::millis();
+	pan_blacklist_t* slot = nullptr;
+	for (auto& e : pan_blacklist) {
+		if (e.used && std::equal(std::begin(addr), std::end(addr), std::begin(e.addr))) {
+			slot = &e;
+			break;
+		}
+		if (slot == nullptr && (!e.used || now - e.since >= PAN_BLACKLIST_COOLDOWN)) {
+			slot = &e;
+		}
+	}
+	if (slot == nullptr) {
+		// all in cooldown, replace the oldest one
+		slot = &*std::max_element(std::begin(pan_blacklist), std::end(pan_blacklist),
+		                          [now](auto& a, auto& b) { return now - a.since < now - b.since; });
+	}
+	std::copy(std::begin(addr), std::end(addr), slot->addr);
+	slot->since = now;
+	slot->used = true;
+	ESP_LOGW(TAG, "PAN %s blacklisted for %lu s", arg::mac(addr).c_str(), PAN_BLACKLIST_COOLDOWN / 1000);
+}
+
+bool
+BRoute::is_pan_blacklisted(const uint8_t (&addr)[8]) const {
+	auto now = esphome::millis();
+	for (auto& e : pan_blacklist) {
+		if (e.used && now - e.since < PAN_BLACKLIST_COOLDOWN && std::equal(std::begin(addr), std::end(addr), std::begin(e.addr))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+BRoute::setup() {
+	if (parent_ == nullptr) {
+		ESP_LOGE(TAG, "No serial specified");
+		mark_failed();
+		return;
+	}
+	if (rb_id == nullptr || rb_password == nullptr) {
+		ESP_LOGE(TAG, "Route B ID/Password not set");
+		mark_failed();
+		return;
+	}
+#ifdef USE_B_ROUTE_POWER
+	if (power_sensor && power_sensor_interval) {
+		set_interval(POWER_TIMER, power_sensor_interval, [this] { request_momentary_power(); });
+#ifdef USE_B_ROUTE_POWER_STATS
+		if (power_stats_enabled()) {
+			set_interval(power_stats_window, [this] { publish_power_stats(); });
+		}
+#endif
+	}
+#endif
+#ifdef USE_B_ROUTE_ENERGY
+	if (energy_sensor) {
+		request_energy_parameters();
+		bool clock_needed = energy_slot_aligned;
+#ifdef USE_B_ROUTE_DEMAND
+		clock_needed = clock_needed || demand_sensor;
+#endif
+		if (clock_needed) {
+			request_meter_clock();
+		}
+		if (energy_sensor_interval) {
+			schedule_energy();
+		}
+	}
+#endif
+#ifdef USE_B_ROUTE_PROPERTIES
+	// entries are sorted by interval, request each run of the same interval in one frame
+	for (size_t i = 0; i < property_count;) {
+		auto j = i;
+		while (j < property_count && j - i < echonet_lite::MAX_PROPERTIES && properties[j].interval == properties[i].interval) {
+			j++;
+		}
+		set_interval(properties[i].interval, [this, i, j] { request_properties(i, j); });
+		i = j;
+	}
+#endif
+	if (recovery_policy_type == RecoveryPolicyType::backoff) {
+		recovery_policy = std::make_unique<recovery::BackoffPolicy>(rejoin_timeout, RECOVERY_BACKOFF_MAX, random_uint32());
+	} else {
+		recovery_policy =
+		    std::make_unique<recovery::FixedPolicy>(rejoin_timeout, rescan_timeout, module_reset_timeout, reboot_timeout);
+	}
+	if (offline_buffer_size) {
+		if (offline_readings.init(offline_buffer_size)) {
+			set_interval(offline_flush_interval, [this] { flush_offline_readings(); });
+		} else {
+			ESP_LOGE(TAG, "Failed to allocate offline buffer of %u bytes", offline_buffer_size);
+		}
+	}
+	if (link_quality_sensor) {
+		set_interval(LINK_QUALITY_INTERVAL, [this] { publish_link_quality(); });
+	}
+	set_interval(UART_STATS_INTERVAL, [this] { log_uart_stats(); });
+	reset_timers();
+	start_init();
+}
+
+void
+BRoute::handle_property_response(const std::byte* raw, const echo::Packet& pkt) {
+#ifdef USE_B_ROUTE_ENERGY
+	meter_clock::datetime_t clock{};
+	bool has_date = false;
+	bool has_time = false;
+#endif
+	for (int i = 0; i < pkt.opc; i++) {
+		auto& prop = pkt.properties[i];
+#ifdef USE_B_ROUTE_ENERGY
+		if (prop.epc == meter::ENERGY_COEFF) {
+			ESP_LOGD(TAG, "coeff received");
+			if (pkt.esv == static_cast<uint8_t>(echo::ESV::Get_SNA) && prop.pdc == 0) {
+				energy_scale.set_coefficient(1);
+				miss_count = 0;
+			} else {
+				if (prop.pdc != sizeof(uint32_t)) {
+					ESP_LOGW(TAG, "property(coeff) len mismatch %u != %u", prop.pdc, sizeof(uint32_t));
+					continue;
+				}
+				miss_count = 0;
+				energy_scale.set_coefficient(echo::Codec::get_unsigned_long(raw + prop.offset));
+			}
+			apply_energy_scale();
+			continue;
+		}
+#endif
+		// Get_SNA still carries the readable properties of the request, only the empty ones are unavailable
+		if (pkt.esv == static_cast<uint8_t>(echo::ESV::Get_SNA) && prop.pdc == 0) {
+			ESP_LOGD(TAG, "Property %02X not available", prop.epc);
+			continue;
+		}
+#ifdef USE_B_ROUTE_ENERGY
+		if (prop.epc == meter::ENERGY_UNIT) {
+			ESP_LOGD(TAG, "unit received");
+			if (prop.pdc != 1) {
+				ESP_LOGW(TAG, "Property(unit) len mismatch %u != 1", prop.pdc);
+				continue;
+			}
+			miss_count = 0;
+			auto v = std::to_integer<uint8_t>(raw[prop.offset]);
+			if (!energy_scale.set_unit(v)) {
+				ESP_LOGW(TAG, "Unknown energy unit %02X", v);
+				continue;
+			}
+			apply_energy_scale();
+			continue;
+		}
+#endif
+		if (prop.epc == meter::GET_PROPERTY_MAP) {
+			// a malformed map must not replace the known one, the decoder clears its output first
+			echo::PropertyMap map{};
+			if (!echo::Codec::decode_property_map(raw + prop.offset, prop.pdc, map)) {
+				ESP_LOGW(TAG, "Invalid property map (%u bytes)", prop.pdc);
+				continue;
+			}
+			property_map = map;
+			property_map_known = true;
+			property_map_pref.save(&property_map);
+			apply_property_map();
+			continue;
+		}
+#ifdef USE_B_ROUTE_POWER
+		if (prop.epc == meter::MOMENTARY_POWER) {
+			ESP_LOGD(TAG, "POWER received");
+			int32_t power;
+			if (prop.pdc != sizeof(power)) {
+				ESP_LOGW(TAG, "Property(momentary power) len mismatch %u != %u", prop.pdc, sizeof(power));
+				continue;
+			}
+			reset_timers();
+			miss_count = 0;
+			power = echo::Codec::get_signed_long(raw + prop.offset);
+			if (power_sensor) {
+				publish_reading(CHANNEL_POWER, power);
+#ifdef USE_B_ROUTE_POWER_STATS
+				if (power_stats_enabled()) {
+					power_stats.add(power);
+				}
+#endif
+			}
+#ifdef USE_B_ROUTE_DEMAND
+			if (demand_sensor && meter_time.valid()) {
+				demand_tracker.add_power(meter_time.now(esphome::millis()), power);
+				update_demand();
+			}
+#endif
+			continue;
+		}
+#endif
+#ifdef USE_B_ROUTE_ENERGY
+		if (prop.epc == meter::SCHEDULED_INTEGRAL_ENERGY_FWD) {
+			ESP_LOGD(TAG, "Scheduled ENERGY received");
+			echo::IntegralPowerWithDateTime data;
+			if (prop.pdc != sizeof(data)) {
+				ESP_LOGW(TAG, "Property(sched integral energy) len mismatch %u != %u", prop.pdc, sizeof(data));
+				continue;
+			}
+			reset_timers();
+			data.year = echo::Codec::get_unsigned_short(raw + prop.offset);
+			std::copy(raw + prop.offset + offsetof(echo::IntegralPowerWithDateTime, mon),
+			          raw + prop.offset + offsetof(echo::IntegralPowerWithDateTime, value),
+			          reinterpret_cast<std::byte*>(&data) + offsetof(echo::IntegralPowerWithDateTime, mon));
+			data.value = echo::Codec::get_unsigned_long(raw + prop.offset + offsetof(echo::IntegralPowerWithDateTime, value));
+			ESP_LOGI(TAG, "Integral data of %04u-%02u-%02u %02u:%02u received: %u", data.year, data.mon, data.day, data.hour,
+			         data.min, data.value);
+			continue;
+		}
+		if (prop.epc == meter::INTEGRAL_ENERGY_FWD) {
+			ESP_LOGD(TAG, "ENERGY received");
+			uint32_t evalue;
+			if (prop.pdc != sizeof(evalue)) {
+				ESP_LOGW(TAG, "Property(integral energy fwd) len mismatch %u != %u", prop.pdc, sizeof(evalue));
+				continue;
+			}
+			reset_timers();
+			miss_count = 0;
+			evalue = echo::Codec::get_unsigned_long(raw + prop.offset);
+#ifdef USE_B_ROUTE_DEMAND
+			if (demand_sensor && meter_time.valid() && energy_scale.ready()) {
+				demand_tracker.add_energy(meter_time.now(esphome::millis()), energy_scale.kwh(evalue), energy_scale.kwh(1));
+				update_demand();
+			}
+#endif
+			if (energy_sensor) {
+				if (evalue < last_energy_counter) {
+					ESP_LOGW(TAG, "Energy counter wrapped around (%u -> %u)", last_energy_counter, evalue);
+				}
+				last_energy_counter = evalue;
+				ESP_LOGV(TAG, "Energy %u * %u * 10^%d(kWh)", evalue, energy_scale.multiplier(), energy_scale.exponent());
+				publish_reading(CHANNEL_ENERGY, evalue);
+			}
+			continue;
+		}
+		if (prop.epc == meter::CURRENT_DATE) {
+			if (prop.pdc != 4) {
+				ESP_LOGW(TAG, "Property(current date) len mismatch %u != 4", prop.pdc);
+				continue;
+			}
+			clock.year = echo::Codec::get_unsigned_short(raw + prop.offset);
+			clock.mon = std::to_integer<uint8_t>(raw[prop.offset + 2]);
+			clock.day = std::to_integer<uint8_t>(raw[prop.offset + 3]);
+			has_date = true;
+			continue;
+		}
+		if (prop.epc == meter::CURRENT_TIME) {
+			if (prop.pdc != 2) {
+				ESP_LOGW(TAG, "Property(current time) len mismatch %u != 2", prop.pdc);
+				continue;
+			}
+			clock.hour = std::to_integer<uint8_t>(raw[prop.offset]);
+			clock.min = std::to_integer<uint8_t>(raw[prop.offset + 1]);
+			has_time = true;
+			continue;
+		}
+#endif
+#ifdef USE_B_ROUTE_PROPERTIES
+		if (handle_custom_property(raw, prop)) {
+			continue;
+		}
+#endif
+		ESP_LOGD(TAG, "Drop property response %02X", prop.epc);
+	}
+#ifdef USE_B_ROUTE_ENERGY
+	if (has_date && has_time) {
+		handle_meter_clock(clock);
+	}
+#endif
+}
+
+const char*
+BRoute::state_name(state_t state) {
+	switch (state) {
+		case state_t::init:
+			return "init";
+		case state_t::joining:
+			return "joining";
+		case state_t::running:
+			return "running";
+		case state_t::scanning:
+			return "scanning";
+		case state_t::setting_values:
+			return "settings";
+		case state_t::wait_ver:
+			return "ver";
+		case state_t::addr_conv:
+			return "addr_conv";
+		case state_t::restarting:
+			return "restarting";
+		case state_t::reauth:
+			return "reauth";
+		case state_t::resetting:
+			return "resetting";
+		default:
+			return "unknown";
+	}
+}
+
+const BRoute::transition_t BRoute::TRANSITIONS[] = {
+    {state_t::wait_ver, event_t::ver, 0, &BRoute::on_version},
+    {state_t::wait_ver, event_t::ok, 0, &BRoute::on_version_ok},
+    {state_t::setting_values, event_t::ok, 0, &BRoute::on_setting_ok},
+    {state_t::setting_values, event_t::info, 0, &BRoute::on_info},
+    {state_t::scanning, event_t::ok, 0, &BRoute::on_scan_ok},
+    {state_t::scanning, event_t::event, 0x22, &BRoute::on_scan_done},
+    {state_t::scanning, event_t::pandesc, 0, &BRoute::on_pandesc},
+    {state_t::scanning, event_t::unknown, 0, &BRoute::on_scan_line},
+    {state_t::addr_conv, event_t::unknown, 0, &BRoute::on_addr_line},
+    {state_t::joining, event_t::ok, 0, &BRoute::on_join_ok},
+    {state_t::joining, event_t::event, 0x25, &BRoute::on_joined},
+    {state_t::joining, event_t::event, 0x24, &BRoute::on_join_failed},
+    {state_t::running, event_t::event, 0x32, &BRoute::on_limit_rate},
+    {state_t::running, event_t::event, 0x33, &BRoute::on_limit_canceled},
+    {state_t::running, event_t::event, 0x29, &BRoute::on_session_expired},
+    {state_t::running, event_t::rxudp, 0, &BRoute::on_rxudp},
+    {state_t::running, event_t::event, 0x21, &BRoute::on_sent_udp},
+    {state_t::joining, event_t::event, 0x21, &BRoute::on_ignore},
+    {state_t::reauth, event_t::event, 0x21, &BRoute::on_ignore},
+    {state_t::setting_values, event_t::sreg, 0, &BRoute::on_session_lifetime},
+    {state_t::reauth, event_t::ok, 0, &BRoute::on_reauth_ok},
+    {state_t::reauth, event_t::event, 0x25, &BRoute::on_joined},
+    {state_t::reauth, event_t::event, 0x24, &BRoute::on_join_failed},
+    {state_t::reauth, event_t::rxudp, 0, &BRoute::on_rxudp},
+};
+
+void
+BRoute::set_state(state_t state, uint32_t timeout) {
+	if (this->state == state_t::restarting) {
+		return;
+	}
+	ESP_LOGV(TAG, "state %s -> %s", state_name(this->state), state_name(state));
+	this->state = state;
+	record_trace(trace::kind_t::state, static_cast<uint8_t>(state));
+	if (timeout) {
+		set_timeout(STATE_TIMER, timeout, [this] { on_state_timeout(); });
+	} else {
+		cancel_timeout(STATE_TIMER);
+	}
+}
+
+void
+BRoute::dispatch(event_t ev, const event_params_t& params) {
+	for (const auto& t : TRANSITIONS) {
+		if (t.state == state && t.ev == ev && (t.event_num == 0 || t.event_num == params.event.num)) {
+			(this->*t.action)(params);
+			return;
+		}
+	}
+	if (ev == event_t::event) {
+		ESP_LOGV(TAG, "%s: %02x: Unhandled event", state_name(state), params.event.num);
+	} else {
+		ESP_LOGV(TAG, "%s: %s: Unhandled input", state_name(state), libbp35::event_str(ev));
+	}
+}
+
+void
+BRoute::send_setting(initial_value_t value) {
+	if (settings_acked == settings_sent) {
+		settings_acked = settings_sent = 0;
+	}
+	if (settings_sent >= std::size(settings_pipeline)) {
+		ESP_LOGE(TAG, "Settings pipeline overflow");
+		return;
+	}
+	switch (value) {
+		case initial_value_t::ver:
+			bp.send_sk("SKVER");
+			break;
+		case initial_value_t::info:
+			bp.send_sk("SKINFO");
+			break;
+		case initial_value_t::echo:
+			// disable echo back
+			bp.send_sk("SKSREG", arg::reg(0xfe), arg::mode(0));
+			break;
+		case initial_value_t::ropt:
+			// test binary mode
+			bp.send_prod("ROPT");
+			break;
+		case initial_value_t::wopt:
+			// set to ascii mode
+			bp.send_prod("WOPT", arg::num8(1));
+			break;
+		case initial_value_t::pwd:
+			bp.send_sk("SKSETPWD", arg::num8(std::strlen(rb_password)), arg::str(rb_password));
+			break;
+		case initial_value_t::rbid:
+			bp.send_sk("SKSETRBID", arg::str(rb_id));
+			break;
+		case initial_value_t::lifetime:
+			bp.send_sk("SKSREG", arg::reg(0x16));
+			break;
+		case initial_value_t::channel:
+			bp.send_sk("SKSREG", arg::reg(0x02), arg::num8(pan_selected.channel));
+			break;
+		case initial_value_t::panid:
+			bp.send_sk("SKSREG", arg::reg(0x03), arg::num16(pan_selected.panid));
+			break;
+	}
+	settings_pipeline[settings_sent++] = value;
+}
+
+bool
+BRoute::next_setting_ack(initial_value_t& value) {
+	if (settings_acked == settings_sent) {
+		return false;
+	}
+	value = settings_pipeline[settings_acked++];
+	return true;
+}
+
+void
+BRoute::start_init() {
+	if (init_started == 0) {
+		init_started = std::max<uint32_t>(esphome::millis(), 1);
+	}
+	settings_acked = settings_sent = 0;
+	info_matched = false;
+	send_setting(initial_value_t::ver);
+	if (settings_applied == APPLIED_ALL && v6_address_set) {
+		// module may still hold our settings, check before applying them again
+		send_setting(initial_value_t::info);
+	} else {
+		send_setting(initial_value_t::echo);
+		send_setting(initial_value_t::ropt);
+	}
+	set_state(state_t::wait_ver, 1'000);
+}
+
+void
+BRoute::start_join() {
+	bp.send_sk("SKJOIN", arg::ipv6(v6_address));
+	set_state(state_t::joining, 10'000);
+}
+
+void
+BRoute::start_scan() {
+	if (init_started) {
+		ESP_LOGI(TAG, "Init to scan: %lu ms", esphome::millis() - init_started);
+		init_started = 0;
+	}
+	pan_count = 0;
+	pan_parsing = {};
+	bp.send_sk("SKSCAN 2 FFFFFFFF 6");
+	set_state(state_t::scanning, 20'000);
+}
+
+void
+BRoute::arm_recovery_timer() {
+	recovery::step_t step;
+	if (!recovery_policy || !is_measurement_requesting() || !recovery_policy->step(recovery_step, step)) {
+		return;
+	}
+	set_timeout(RECOVERY_TIMER, step.delay, [this, step] { on_recovery_deadline(step.action); });
+}
+
+void
+BRoute::reset_timers() {
+	auto now = esphome::millis();
+	last_data_received = now;
+	if (recovery_started) {
+		auto elapsed = now - recovery_started;
+		recovery_counters.recoveries++;
+		recovery_counters.recovery_time_total += elapsed;
+		ESP_LOGI(TAG, "Recovered in %lu ms after %u step(s); rejoin=%u, rescan=%u, module reset=%u, mean recovery=%lu ms",
+		         elapsed, recovery_step, recovery_counters.rejoins, recovery_counters.rescans, recovery_counters.module_resets,
+		         recovery_counters.recovery_time_total / recovery_counters.recoveries);
+		recovery_started = 0;
+	}
+	recovery_step = 0;
+	arm_recovery_timer();
+}
+
+void
+BRoute::perform_recovery(recovery::action_t action) {
+	if (recovery_started == 0) {
+		recovery_started = esphome::millis();
+	}
+	switch (action) {
+		case recovery::action_t::rejoin:
+			recovery_counters.rejoins++;
+			start_join();
+			break;
+		case recovery::action_t::rescan:
+			recovery_counters.rescans++;
+			start_scan();
+			break;
+		case recovery::action_t::reset_module:
+			recovery_counters.module_resets++;
+			reset_module();
+			break;
+		case recovery::action_t::reboot:
+			recovery_counters.reboots++;
+			set_state(state_t::restarting, RESTART_DELAY);
+			break;
+	}
+}
+
+void
+BRoute::reset_module() {
+	ESP_LOGW(TAG, "Reset Wi-SUN module");
+	bp.send_sk("SKRESET");
+	settings_applied = 0;
+	tx_limited = false;
+	set_state(state_t::resetting, MODULE_RESET_DELAY);
+}
+
+void
+BRoute::on_state_timeout() {
+	switch (state) {
+		case state_t::restarting:
+			mark_failed();
+			App.safe_reboot();
+			return;
+		case state_t::resetting:
+			start_init();
+			return;
+		case state_t::wait_ver:
+			if (++module_unresponsive >= MODULE_HARD_FAULT_COUNT) {
+				module_unresponsive = 0;
+				if (!module_reset_tried) {
+					ESP_LOGE(TAG, "Wi-SUN module not responding");
+					module_reset_tried = true;
+					recovery_counters.module_resets++;
+					reset_module();
+				} else {
+					ESP_LOGE(TAG, "Wi-SUN module not responding after reset, restart");
+					recovery_counters.reboots++;
+					set_state(state_t::restarting, RESTART_DELAY);
+				}
+				return;
+			}
+			break;
+		default:
+			break;
+	}
+	ESP_LOGW(TAG, "%s: State timeout, re-run from init", state_name(state));
+	set_state(state_t::init, 0);
+	start_init();
+}
+
+void
+BRoute::on_recovery_deadline(recovery::action_t action) {
+	auto elapsed = esphome::millis() - last_data_received;
+	// rejoin/rescan only interrupt a running session, other states are already reconnecting
+	if (action == recovery::action_t::reset_module || action == recovery::action_t::reboot || state == state_t::running) {
+		switch (action) {
+			case recovery::action_t::rejoin:
+				ESP_LOGI(TAG, "計測データを %lu 秒間受信していません。再接続します", elapsed / 1000);
+				break;
+			case recovery::action_t::rescan:
+				ESP_LOGE(TAG, "計測データを %lu 秒間受信していません。再スキャンします", elapsed / 1000);
+				break;
+			case recovery::action_t::reset_module:
+				ESP_LOGE(TAG, "計測データを %lu 秒間受信していません。モジュールをリセットします", elapsed / 1000);
+				break;
+			case recovery::action_t::reboot:
+				ESP_LOGE(TAG, "計測データを %lu 秒間受信していません。再起動します", elapsed / 1000);
+				break;
+		}
+		ESP_LOGD(TAG, "Recovery(%s) step %u: %s", recovery_policy->name(), recovery_step, recovery::action_str(action));
+		perform_recovery(action);
 	}
-	App.scheduler.set_timeout(this, params_task, rc ? REQUEST_RETRY_INTERVAL : SEND_RETRY_INTERVAL,
-	                          [this] { request_energy_parameters(); });
+	recovery_step++;
+	arm_recovery_timer();
 }
 
 void
-BRoute::request_momentary_power() {
-	auto rc = request_property(PROPS_MOMENTARY_POWER);
-	if (rc) {
-		ESP_LOGD(TAG, "POWER requested");
+BRoute::on_version(const event_params_t& params) {
+	module_unresponsive = 0;
+	module_reset_tried = false;
+	ESP_LOGD(TAG, "VER=%s", params.remain.data());
+}
+
+void
+BRoute::on_version_ok(const event_params_t&) {
+	initial_value_t value;
+	if (next_setting_ack(value) && value == initial_value_t::ver) {
+		// following commands are already in flight
+		set_state(state_t::setting_values, 1'000);
 	}
-	App.scheduler.set_timeout(this, power_task, rc ? REQUEST_RETRY_INTERVAL : SEND_RETRY_INTERVAL,
-	                          [this] { request_momentary_power(); });
 }
 
 void
-BRoute::request_integral_energy() {
-	auto rc = energy_params_received() && request_property(PROPS_INTEGRAL_ENERGY);
-	if (rc) {
-		ESP_LOGD(TAG, "ENERGY requested");
+BRoute::on_setting_ok(const event_params_t& params) {
+	initial_value_t value;
+	if (!next_setting_ack(value)) {
+		ESP_LOGW(TAG, "Unexpected OK");
+		return;
+	}
+	set_state(state_t::setting_values, 1'000);
+	switch (value) {
+		case initial_value_t::info:
+			if (info_matched) {
+				ESP_LOGI(TAG, "Module settings retained, skip to join");
+				start_join();
+			} else {
+				settings_applied = 0;
+				send_setting(initial_value_t::echo);
+				send_setting(initial_value_t::ropt);
+			}
+			break;
+		case initial_value_t::echo:
+			settings_applied |= APPLIED_ECHO;
+			break;
+		case initial_value_t::ropt:
+			ESP_LOGD(TAG, "ropt=%s", params.remain.data());
+			if (params.remain != "01") {
+				send_setting(initial_value_t::wopt);
+				break;
+			} else {
+				[[fallthrough]];
+			}
+		case initial_value_t::wopt:
+			settings_applied |= APPLIED_ASCII;
+			send_setting(initial_value_t::pwd);
+			send_setting(initial_value_t::rbid);
+			send_setting(initial_value_t::lifetime);
+			break;
+		case initial_value_t::pwd:
+			break;
+		case initial_value_t::rbid:
+			settings_applied |= APPLIED_AUTH;
+			break;
+		case initial_value_t::lifetime:
+			start_scan();
+			break;
+		case initial_value_t::channel:
+			break;
+		case initial_value_t::panid:
+			start_join();
+			break;
+		default:
+			ESP_LOGE(TAG, "%d: Unexpected setting value type", static_cast<int>(value));
+			break;
 	}
-	App.scheduler.set_timeout(this, energy_task, rc ? REQUEST_RETRY_INTERVAL : SEND_RETRY_INTERVAL,
-	                          [this] { request_integral_energy(); });
 }
 
-bool
-BRoute::test_nw_info() const {
-	ESP_LOGD(TAG, "scan data: mac=%s, panid=%s, channel=%s", mac.c_str(), panid.c_str(), channel.c_str());
-	if (mac.empty() && panid.empty() && channel.empty()) {
-		return false;
+void
+BRoute::on_info(const event_params_t& params) {
+	// EINFO <IPADDR> <ADDR64> <CHANNEL> <PANID> <ADDR16>
+	auto remain = params.remain;
+	std::string_view fields[5];
+	for (auto& f : fields) {
+		auto sep = remain.find(' ');
+		f = remain.substr(0, sep);
+		remain = sep == remain.npos ? std::string_view{} : remain.substr(sep + 1);
 	}
-	if (mac.length() != 16 || panid.length() != 4 || channel.length() != 2) {
-		ESP_LOGE(TAG, "Unexpected scan data: mac=%s, panid=%s, channel=%s", mac.c_str(), panid.c_str(), channel.c_str());
-		return false;
+	uint8_t info_channel = 0;
+	uint16_t info_panid = 0;
+	auto ch = fields[2].data();
+	auto id = fields[3].data();
+	info_matched = pan_selected.complete() && fields[2].size() == 2 && fields[3].size() == 4 &&
+	               arg::get_num8(ch, ch + 2, info_channel) && arg::get_num16(id, id + 4, info_panid) &&
+	               info_channel == pan_selected.channel && info_panid == pan_selected.panid;
+	ESP_LOGD(TAG, "info: channel=%.*s, panid=%.*s%s", static_cast<int>(fields[2].size()), fields[2].data(),
+	         static_cast<int>(fields[3].size()), fields[3].data(), info_matched ? "" : " (not configured)");
+}
+
+void
+BRoute::on_scan_ok(const event_params_t&) {
+	ESP_LOGI(TAG, "Scanning...");
+}
+
+void
+BRoute::on_pandesc(const event_params_t&) {
+	commit_pan();
+}
+
+void
+BRoute::on_scan_line(const event_params_t& params) {
+	BP35::parse_pandesc_line(params.line, pan_parsing);
+}
+
+void
+BRoute::on_scan_done(const event_params_t&) {
+	commit_pan();
+	if (select_pan()) {
+		ESP_LOGI(TAG, "Scan done");
+		bp.send_sk("SKLL64", arg::mac(pan_selected.addr));
+		set_state(state_t::addr_conv, 1'000);
+	} else {
+		ESP_LOGW(TAG, "Scan done but no PAN found, scan again");
+		start_scan();
 	}
-	return true;
 }
 
 void
-BRoute::setup() {
-	if (parent_ == nullptr) {
-		ESP_LOGE(TAG, "No serial specified");
-		mark_failed();
+BRoute::on_addr_line(const event_params_t& params) {
+	if (params.line.rfind("SKLL", 0) == 0) {
 		return;
 	}
-	if (rb_id == nullptr || rb_password == nullptr) {
-		ESP_LOGE(TAG, "Route B ID/Password not set");
-		mark_failed();
-		return;
+	auto cur = params.line.data();
+	if (params.line.length() == 39 && arg::get_ipv6(cur, cur + 39, v6_address)) {
+		v6_address_set = true;
+		send_setting(initial_value_t::channel);
+		send_setting(initial_value_t::panid);
+		set_state(state_t::setting_values, 1'000);
 	}
-	if (power_sensor || energy_sensor) {
-		request_energy_parameters();
+}
+
+void
+BRoute::on_join_ok(const event_params_t&) {
+	ESP_LOGI(TAG, "Joining...");
+}
+
+void
+BRoute::on_joined(const event_params_t&) {
+	ESP_LOGI(TAG, "Joined");
+	auto now = esphome::millis();
+	if (init_started) {
+		ESP_LOGI(TAG, "Init to join: %lu ms", now - init_started);
+		init_started = 0;
 	}
-	if (power_sensor && power_sensor_interval) {
-		set_interval(power_sensor_interval, [this] { request_momentary_power(); });
+	if (session_expired_at) {
+		ESP_LOGI(TAG, "Session expiry to rejoin: %lu ms", now - session_expired_at);
+		session_expired_at = 0;
 	}
-	if (energy_sensor && energy_sensor_interval) {
-		set_interval(energy_sensor_interval, [this] { request_integral_energy(); });
+	set_state(state_t::running, 0);
+	log_heap();
+	reauth_pending = false;
+	auto lifetime = session_lifetime ? session_lifetime : DEFAULT_SESSION_LIFETIME;
+	auto margin = std::clamp(lifetime / 10, REAUTH_MARGIN_MIN, REAUTH_MARGIN_MAX);
+	if (lifetime > margin * 2) {
+		set_timeout(REAUTH_TIMER, lifetime - margin, [this] { on_reauth_timer(); });
+		// re-authenticate even if no quiet window was found
+		set_timeout(REAUTH_DEADLINE_TIMER, lifetime - margin / 2, [this] { start_reauth(); });
 	}
-	reset_timers();
+	load_meter_eoj();
+	load_property_map();
+	resend_inflight();
+	pump_requests();
 }
 
 void
-BRoute::handle_property_response(const std::byte* raw, const echo::Packet& pkt) {
-	for (int i = 0; i < pkt.opc; i++) {
-		auto& prop = pkt.properties[i];
-		if (prop.epc == meter::ENERGY_COEFF) {
-			ESP_LOGD(TAG, "coeff received");
-			if (pkt.esv == static_cast<uint8_t>(echo::ESV::Get_SNA) && prop.pdc == 0) {
-				energy_coeff = 1;
-				miss_count = 0;
-			} else {
-				if (prop.pdc != sizeof(energy_coeff)) {
-					ESP_LOGW(TAG, "property(coeff) len mismatch %u != %u", prop.pdc, sizeof(energy_coeff));
-					continue;
-				}
-				miss_count = 0;
-				energy_coeff = echo::Codec::get_signed_long(raw + prop.offset);
-			}
-			if (energy_params_received()) {
-				App.scheduler.cancel_timeout(this, params_task);
-			}
-			continue;
-		} else if (prop.epc == meter::ENERGY_UNIT) {
-			ESP_LOGD(TAG, "unit received");
-			if (prop.pdc != 1) {
-				ESP_LOGW(TAG, "Property(unit) len mismatch %u != 1", prop.pdc);
-				continue;
-			}
-			miss_count = 0;
-			auto v = std::to_integer<int8_t>(raw[prop.offset]);
-			energy_unit = v > 10 ? std::pow(10.0f, v - 9) : std::pow(10.0f, -v);
-			if (energy_params_received()) {
-				App.scheduler.cancel_timeout(this, params_task);
-				if (energy_sensor) {
-					int8_t prec = 0;
-					if (v < 10) {
-						prec = static_cast<int>(std::ceil(v - std::log10(static_cast<float>(energy_coeff))));
-						energy_sensor->set_accuracy_decimals(prec);
-					}
-				}
-			}
-			continue;
-		}
-		if (pkt.esv == static_cast<uint8_t>(echo::ESV::Get_SNA)) {
-			continue;
-		}
-		if (prop.epc == meter::MOMENTARY_POWER) {
-			ESP_LOGD(TAG, "POWER received");
-			App.scheduler.cancel_timeout(this, power_task);
-			int32_t power;
-			if (prop.pdc != sizeof(power)) {
-				ESP_LOGW(TAG, "Property(momentary power) len mismatch %u != %u", prop.pdc, sizeof(power));
-				continue;
-			}
-			reset_timers();
-			miss_count = 0;
-			if (power_sensor) {
-				power = echo::Codec::get_signed_long(raw + prop.offset);
-				power_sensor->publish_state(power);
-			}
-		} else if (prop.epc == meter::SCHEDULED_INTEGRAL_ENERGY_FWD) {
-			ESP_LOGD(TAG, "Scheduled ENERGY received");
-			echo::IntegralPowerWithDateTime data;
-			if (prop.pdc != sizeof(data)) {
-				ESP_LOGW(TAG, "Property(sched integral energy) len mismatch %u != %u", prop.pdc, sizeof(data));
-				continue;
-			}
-			reset_timers();
-			data.year = echo::Codec::get_unsigned_short(raw + prop.offset);
-			std::copy(raw + prop.offset + offsetof(echo::IntegralPowerWithDateTime, mon),
-			          raw + prop.offset + offsetof(echo::IntegralPowerWithDateTime, value),
-			          reinterpret_cast<std::byte*>(&data) + offsetof(echo::IntegralPowerWithDateTime, mon));
-			data.value = echo::Codec::get_unsigned_long(raw + prop.offset + offsetof(echo::IntegralPowerWithDateTime, value));
-			ESP_LOGI(TAG, "Integral data of %02u:%02u received", data.hour, data.min);
-		} else if (prop.epc == meter::INTEGRAL_ENERGY_FWD) {
-			ESP_LOGD(TAG, "ENERGY received");
-			App.scheduler.cancel_timeout(this, energy_task);
-			uint32_t evalue;
-			if (prop.pdc != sizeof(evalue)) {
-				ESP_LOGW(TAG, "Property(integral energy fwd) len mismatch %u != %u", prop.pdc, sizeof(evalue));
-				continue;
-			}
-			reset_timers();
-			miss_count = 0;
-			if (energy_sensor) {
-				evalue = echo::Codec::get_unsigned_long(raw + prop.offset);
-				auto fenergy = energy_unit * evalue * energy_coeff;
-				ESP_LOGV(TAG, "Energy %.3f = %.4f(kWh) * %u * %d, prec=%d", fenergy, energy_unit, evalue, energy_coeff,
-				         energy_sensor->get_accuracy_decimals());
-				energy_sensor->publish_state(fenergy);
-			}
-		} else {
-			ESP_LOGD(TAG, "Drop property response %02X", prop.epc);
-		}
+BRoute::on_join_failed(const event_params_t&) {
+	ESP_LOGW(TAG, "Failed to join, try scan and join");
+	if (pan_selected.complete()) {
+		blacklist_pan(pan_selected.addr);
 	}
+	start_scan();
 }
 
-const char*
-BRoute::state_name(state_t state) {
-	switch (state) {
-		case state_t::init:
-			return "init";
-		case state_t::joining:
-			return "joining";
-		case state_t::running:
-			return "running";
-		case state_t::scanning:
-			return "scanning";
-		case state_t::setting_values:
-			return "settings";
-		case state_t::wait_ver:
-			return "ver";
-		case state_t::addr_conv:
-			return "addr_conv";
-		case state_t::restarting:
-			return "restarting";
-		default:
-			return "unknown";
+void
+BRoute::on_limit_rate(const event_params_t&) {
+	ESP_LOGW(TAG, "Transmit time limit activated");
+	tx_limited = true;
+	stop_burst();
+}
+
+void
+BRoute::on_limit_canceled(const event_params_t&) {
+	ESP_LOGW(TAG, "Transmit time limit cleared");
+	tx_limited = false;
+}
+
+void
+BRoute::on_session_expired(const event_params_t&) {
+	ESP_LOGI(TAG, "Session expired, waiting re-join");
+	session_expired_at = std::max<uint32_t>(esphome::millis(), 1);
+	set_state(state_t::joining, 10'000);
+}
+
+void
+BRoute::on_session_lifetime(const event_params_t& params) {
+	auto cur = std::cbegin(params.remain);
+	uint32_t sec;
+	if (arg::get_num32(cur, std::cend(params.remain), sec)) {
+		ESP_LOGD(TAG, "PANA session lifetime %u s", sec);
+		session_lifetime = sec * 1000;
 	}
 }
 
 void
-BRoute::set_state(state_t state, uint32_t timeout) {
-	if (this->state == state_t::restarting) {
+BRoute::on_reauth_timer() {
+	if (state != state_t::running) {
 		return;
 	}
-	this->state = state;
-	state_timeout = timeout;
-	state_started = esphome::millis();
+	if (awaiting_response) {
+		// wait for the in-flight response, re-authenticate right after it
+		ESP_LOGD(TAG, "Re-authentication deferred until response");
+		reauth_pending = true;
+		return;
+	}
+	start_reauth();
 }
 
 void
-BRoute::start_join() {
-	bp.send_sk("SKJOIN", arg::str(v6_address));
-	set_state(state_t::joining, 10'000);
+BRoute::start_reauth() {
+	if (state != state_t::running) {
+		return;
+	}
+	ESP_LOGI(TAG, "Re-authenticate before session expiry");
+	reauth_pending = false;
+	cancel_timeout(REAUTH_TIMER);
+	cancel_timeout(REAUTH_DEADLINE_TIMER);
+	bp.send_sk("SKREJOIN");
+	set_state(state_t::reauth, 10'000);
 }
 
 void
-BRoute::start_scan() {
-	mac.clear();
-	panid.clear();
-	channel.clear();
-	bp.send_sk("SKSCAN 2 FFFFFFFF 6");
-	set_state(state_t::scanning, 20'000);
+BRoute::on_reauth_ok(const event_params_t&) {
+	ESP_LOGD(TAG, "Re-authenticating...");
+}
+
+void
+BRoute::on_sent_udp(const event_params_t& params) {
+	if (!params.event.has_param || params.event.param != 0x01 || !awaiting_response) {
+		return;
+	}
+	// the request never left the module, so it is not a meter miss
+	send_failures++;
+	if (send_retries == 0 && miss_count) {
+		miss_count--;
+	}
+	if (send_retries >= MAX_SEND_RETRIES) {
+		ESP_LOGW(TAG, "Send failed %u times, give up (send failures=%u, no responses=%u)", send_retries + 1, send_failures,
+		         no_responses);
+		drop_inflight();
+		awaiting_response = false;
+		request_done = std::max<uint32_t>(esphome::millis(), 1);
+		record_link_result(false);
+		pump_requests();
+		return;
+	}
+	send_retries++;
+	ESP_LOGD(TAG, "Send failed, retransmit %u/%u", send_retries, MAX_SEND_RETRIES);
+	resend_inflight();
+}
+
+void
+BRoute::on_ignore(const event_params_t&) {}
+
+void
+BRoute::on_rxudp(const event_params_t& params) {
+	handle_rxudp(params.remain);
 }
 
 void
 BRoute::handle_rxudp(std::string_view hexstr) {
-	ESP_LOGV(TAG, "RXUDP: %s", hexstr.data());
-	auto start = esphome::millis();
-	rxudp_t rxudp;
-	if (!BP35::parse_rxudp(hexstr, rxudp)) {
+	// cheapest checks first, most of the traffic on a busy PAN is not for us
+	uint16_t lport;
+	if (!BP35::parse_rxudp_lport(hexstr, lport)) {
+		rx_stats.malformed++;
+		record_trace(trace::kind_t::rx_drop, static_cast<uint8_t>(trace::drop_t::malformed));
 		ESP_LOGW(TAG, "%s: Failed to parse rxudp, skipped", hexstr.data());
 		return;
 	}
-	if (rxudp.lport != echo::UDP_PORT) {
-		ESP_LOGD(TAG, "%u: Destination port is not for EchonetLite", rxudp.lport);
+	if (lport != echo::UDP_PORT) {
+		rx_stats.port++;
+		record_trace(trace::kind_t::rx_drop, static_cast<uint8_t>(trace::drop_t::port), 0, 0, lport);
 		return;
 	}
-	ESP_LOGV(TAG, "udp data len = %u, datastr = %s", rxudp.data_len, hexstr.data() + rxudp.data_pos);
-	size_t len;
-	if (!util::hex2bin(&hexstr[rxudp.data_pos], buffer, len) || len != rxudp.data_len) {
-		ESP_LOGW(TAG, "%s: Failed to decode udp data", &hexstr[rxudp.data_pos]);
+	rxudp_t rxudp;
+	if (!B_ROUTE_PROFILED(parse_rxudp, BP35::parse_rxudp(hexstr, rxudp))) {
+		rx_stats.malformed++;
+		record_trace(trace::kind_t::rx_drop, static_cast<uint8_t>(trace::drop_t::malformed));
+		ESP_LOGW(TAG, "%s: Failed to parse rxudp, skipped", hexstr.data());
 		return;
 	}
+	if (rxudp.has_rssi) {
+		link_rssi.add(rxudp.rssi);
+	}
+	auto data = hexstr.substr(rxudp.data_pos);
+	constexpr auto header_size = echo::Codec::HEADER_SIZE;
+	size_t len;
 	echo::Packet pkt;
-	if (!echo::Codec::decode_packet(buffer.data(), len, pkt)) {
-		ESP_LOGW(TAG, "%s: Failed to decode echonet packet", &hexstr[rxudp.data_pos]);
+	if (data.size() != rxudp.data_len * 2u ||
+	    !B_ROUTE_PROFILED(hex2bin, util::hex2bin(data.substr(0, header_size * 2), buffer, len)) ||
+	    !B_ROUTE_PROFILED(decode, echo::Codec::decode_header(buffer.data(), len, pkt))) {
+		rx_stats.header++;
+		record_trace(trace::kind_t::rx_drop, static_cast<uint8_t>(trace::drop_t::header));
+		return;
+	}
+	// low power smart meter, any instance until the instance list is known, and its node profile
+	bool from_node_profile = pkt.seoj.X1 == EOJ_NODE_PROFILE.X1 && pkt.seoj.X2 == EOJ_NODE_PROFILE.X2;
+	bool from_meter = pkt.seoj.X1 == meter_eoj.X1 && pkt.seoj.X2 == meter_eoj.X2 &&
+	                  (!meter_eoj_known || pkt.seoj.X3 == meter_eoj.X3);
+	if (!from_node_profile && !from_meter) {
+		rx_stats.seoj++;
+		record_trace(trace::kind_t::rx_drop, static_cast<uint8_t>(trace::drop_t::seoj), 0, pkt.tid);
 		return;
 	}
-	if (pkt.ehd1 != echo::EHD1 || pkt.ehd2 != echo::EHD2_Format1) {
+	if (pkt.esv != static_cast<uint8_t>(echo::ESV::Get_Res) && pkt.esv != static_cast<uint8_t>(echo::ESV::INF) &&
+	    pkt.esv != static_cast<uint8_t>(echo::ESV::Get_SNA)) {
+		rx_stats.esv++;
+		record_trace(trace::kind_t::rx_drop, static_cast<uint8_t>(trace::drop_t::esv), pkt.esv, pkt.tid);
 		return;
 	}
-	// handle low power smart meter
-	if (pkt.seoj.X1 != 0x02 || pkt.seoj.X2 != 0x88) {
+	size_t body_len;
+	auto body = data.substr(header_size * 2);
+	if (!B_ROUTE_PROFILED(hex2bin, util::hex2bin(body, buffer.data() + header_size, buffer.size() - header_size, body_len)) ||
+	    !B_ROUTE_PROFILED(decode, echo::Codec::decode_properties(buffer.data(), header_size + body_len, pkt))) {
+		rx_stats.properties++;
+		record_trace(trace::kind_t::rx_drop, static_cast<uint8_t>(trace::drop_t::properties), pkt.esv, pkt.tid);
+		ESP_LOGW(TAG, "%s: Failed to decode echonet packet", data.data());
 		return;
 	}
-	ESP_LOGV(TAG, "Echonet ehd=%02x,%02x deoj=%02x%02x%02x, esv=%02x, npc=%u, epc[0]=%02x", pkt.ehd1, pkt.ehd2, pkt.deoj.X1,
-	         pkt.deoj.X2, pkt.deoj.X3, pkt.esv, pkt.opc, pkt.opc == 0 ? -1 : pkt.properties[0].epc);
-	if (pkt.esv == static_cast<uint8_t>(echo::ESV::Get_Res) || pkt.esv == static_cast<uint8_t>(echo::ESV::INF) ||
-	    pkt.esv == static_cast<uint8_t>(echo::ESV::Get_SNA)) {
-		handle_property_response(buffer.data(), pkt);
+	rx_stats.accepted++;
+	record_trace(trace::kind_t::rx, pkt.opc ? pkt.properties[0].epc : 0, pkt.esv, pkt.tid, pkt.opc);
+	if (from_node_profile) {
+		handle_node_profile(buffer.data(), pkt);
+	} else {
+		{
+			B_ROUTE_PROBE(handle_response);
+			handle_property_response(buffer.data(), pkt);
+		}
+		update_cache(buffer.data(), pkt);
+	}
+	// INF is sent by the meter on its own, only a response with our TID frees the radio slot
+	if (pkt.esv != static_cast<uint8_t>(echo::ESV::INF) && awaiting_response && pkt.tid == inflight_tid) {
+		complete_request();
 	}
 }
 
 libbp35::event_t
 BRoute::get_event(event_params_t& params) {
-	auto ev = bp.get_event(100, params);
+	auto ev = bp.get_event(params);
 	if (ev != event_t::none) {
-		if (ev == event_t::event) {
-			ESP_LOGV(TAG, "ev = %s(%s)", libbp35::event_str(ev), libbp35::event_num_str(params.event.num));
-		} else {
-			ESP_LOGV(TAG, "ev = %s, line=%s", libbp35::event_str(ev), params.line.c_str());
-		}
+		record_trace(trace::kind_t::event, static_cast<uint8_t>(ev), ev == event_t::event ? params.event.num : 0);
 	}
 	return ev;
 }
 
 void
 BRoute::loop() {
+	if (state == state_t::restarting) {
+		return;
+	}
+	B_ROUTE_PROBE(loop);
 	event_params_t params{};
-	auto ev = get_event(params);
-	switch (state) {
-		case state_t::restarting:
-			if (esphome::millis() - state_started >= RESTART_DELAY) {
-				mark_failed();
-				App.safe_reboot();
-			}
-			return;  // DO NOT DO ANYTHING
-		case state_t::init:
-			bp.send_sk("SKVER");
-			set_state(state_t::wait_ver, 1'000);
-			break;
-		case state_t::wait_ver:
-			if (ev == event_t::ver) {
-				ESP_LOGD(TAG, "VER=%s", params.remain.data());
-			} else if (ev == event_t::ok) {
-				// disable echo back
-				bp.send_sk("SKSREG", arg::reg(0xfe), arg::mode(0));
-				set_state(state_t::setting_values, 1'000);
-				setting_value = initial_value_t::echo;
-			}
-			break;
-		case state_t::setting_values:
-			if (ev == event_t::ok) {
-				switch (setting_value) {
-					case initial_value_t::echo:
-						// test binary mode
-						bp.send_prod("ROPT");
-						setting_value = initial_value_t::ropt;
-						break;
-					case initial_value_t::ropt:
-						ESP_LOGD(TAG, "ropt=%s", params.remain.data());
-						if (params.remain != "01") {
-							// set to ascii mode
-							bp.send_prod("WOPT", arg::num8(1));
-							setting_value = initial_value_t::wopt;
-							break;
-						} else {
-							[[fallthrough]];
-						}
-					case initial_value_t::wopt:
-						bp.send_sk("SKSETPWD", arg::num8(std::strlen(rb_password)), arg::str(rb_password));
-						set_state(state_t::setting_values, 1'000);
-						setting_value = initial_value_t::pwd;
-						break;
-					case initial_value_t::pwd:
-						bp.send_sk("SKSETRBID", arg::str(rb_id));
-						setting_value = initial_value_t::rbid;
-						break;
-					case initial_value_t::rbid:
-						start_scan();
-						break;
-					case initial_value_t::channel:
-						bp.send_sk("SKSREG", arg::reg(0x03), arg::str(panid));
-						setting_value = initial_value_t::panid;
-						break;
-					case initial_value_t::panid:
-						start_join();
-						break;
-					default:
-						ESP_LOGE(TAG, "%d: Unexpected setting value type", static_cast<int>(setting_value));
-						break;
-				}
-			}
-			break;
-		case state_t::addr_conv:
-			if (ev == event_t::unknown) {
-				if (params.line.rfind("SKLL", 0) == 0) {
-					break;
-				}
-				if (params.line.length() == 39) {
-					v6_address = params.line;
-					bp.send_sk("SKSREG", arg::reg(0x02), arg::str(channel));
-					setting_value = initial_value_t::channel;
-					set_state(state_t::setting_values, 1'000);
-				}
-			}
-			break;
-		case state_t::scanning:
-			if (ev == event_t::ok) {
-				ESP_LOGI(TAG, "Scanning...");
-			} else if (ev == event_t::event && params.event.num == 0x22) {
-				if (test_nw_info()) {
-					ESP_LOGI(TAG, "Scan done");
-					rescan_timer = esphome::millis();
-					bp.send_sk("SKLL64", arg::str(mac));
-					set_state(state_t::addr_conv, 1'000);
-				} else {
-					ESP_LOGW(TAG, "Scan done but channel not received, scan again");
-					start_scan();
-				}
-				break;
-			} else if (ev == event_t::unknown && params.line[0] == ' ') {
-				auto line = util::trim_sv(params.line);
-				if (line.rfind(SCAN_KEY_ADDR, 0) == 0) {
-					mac = line.substr(SCAN_KEY_ADDR.length());
-				} else if (line.rfind(SCAN_KEY_PANID, 0) == 0) {
-					panid = line.substr(SCAN_KEY_PANID.length());
-				} else if (line.rfind(SCAN_KEY_CHANNEL, 0) == 0) {
-					channel = line.substr(SCAN_KEY_CHANNEL.length());
-				}
-			}
-			break;
-		case state_t::joining:
-			if (ev == event_t::ok) {
-				ESP_LOGI(TAG, "Joining...");
-			} else if (ev == event_t::event) {
-				if (params.event.num == 0x25) {
-					ESP_LOGI(TAG, "Joined");
-					set_state(state_t::running, 0);
-					rejoin_timer = esphome::millis();
-				} else if (params.event.num == 0x24) {
-					ESP_LOGW(TAG, "Failed to join, try scan and join");
-					start_scan();
-				} else {
-					if (params.event.num != 0x21) {
-						ESP_LOGD(TAG, "%02x: Ignore event", params.event.num);
-					}
-				}
-			}
-			break;
-		case state_t::running: {
-			switch (ev) {
-				case event_t::event:
-					switch (params.event.num) {
-						case 0x32:
-							ESP_LOGW(TAG, "Transmit time limit activated");
-							break;
-						case 0x33:
-							ESP_LOGW(TAG, "Transmit time limit cleared");
-							break;
-						case 0x29:
-							ESP_LOGI(TAG, "Session expired, waiting re-join");
-							set_state(state_t::joining, 10'000);
-							break;
-						default:
-							ESP_LOGV(TAG, "%02x: Unhandled event", params.event.num);
-							break;
-					}
-					break;
-				case event_t::rxudp:
-					handle_rxudp(params.remain);
-					break;
-				case event_t::none:
-					break;
-				default:
-					ESP_LOGV(TAG, "%d: Unhandled input", static_cast<int>(ev));
-					break;
-			}
-			if (rescan_timeout && is_measurement_requesting()) {
-				if (auto elapsed = esphome::millis() - rescan_timer; elapsed > rescan_timeout) {
-					ESP_LOGE(TAG, "計測データを %lu 秒間受信していません。再スキャンします", elapsed / 1000);
-					start_scan();
-					break;
-				}
-			}
-			if (rejoin_timeout && is_measurement_requesting()) {
-				if (auto elapsed = esphome::millis() - rejoin_timer; elapsed > rejoin_timeout) {
-					ESP_LOGI(TAG, "計測データを %lu 秒間受信していません。再接続します", elapsed / 1000);
-					start_join();
-					break;
-				}
-			}
-		} break;
-		default:
-			ESP_LOGD(TAG, "%d: Unhandled state", static_cast<int>(state));
+	for (int i = 0; i < MAX_LINES_PER_LOOP && available() > 0; i++) {
+		auto ev = get_event(params);
+		if (ev == event_t::none) {
 			break;
+		}
+		dispatch(ev, params);
 	}
-	if (reboot_timeout && is_measurement_requesting()) {
-		if (auto elapsed = esphome::millis() - reboot_timer; elapsed > reboot_timeout) {
-			ESP_LOGE(TAG, "計測データを %lu 秒間受信していません。再起動します", elapsed / 1000);
-			set_state(state_t::restarting, 0);
-			return;
+	if (bp.line_pending()) {
+		line_receiving.start();
+	} else {
+		line_receiving.stop();
+	}
+}
+
+void
+BRoute::dump_trace() const {
+	constexpr size_t per_line = 8;
+	char line[per_line * sizeof(trace::entry_t) * 2 + 1];
+	ESP_LOGI(TAG, "trace begin %lu %u/%lu", esphome::millis(), trace_buffer.size(), trace_buffer.total());
+	for (size_t i = 0; i < trace_buffer.size(); i += per_line) {
+		trace_buffer.hex(i, per_line, line);
+		ESP_LOGI(TAG, "trace %s", line);
+	}
+	ESP_LOGI(TAG, "trace end");
+}
+
+void
+BRoute::dump_profile(bool reset) {
+#ifdef USE_B_ROUTE_PROFILE
+	using profile::Histogram;
+	auto per_us = std::max<uint32_t>(profile::ticks_per_us(), 1);
+	ESP_LOGI(TAG, "profile: %" PRIu32 " ticks/us, first bucket below %u ticks, doubling", per_us, 2u << Histogram::MIN_SHIFT);
+	for (size_t s = 0; s < profile::histograms.size(); s++) {
+		auto& h = profile::histograms[s];
+		if (h.count() == 0) {
+			continue;
+		}
+		char buckets[Histogram::BUCKETS * 11 + 1];
+		char* p = buckets;
+		for (size_t i = 0; i < Histogram::BUCKETS; i++) {
+			p += snprintf(p, buckets + sizeof(buckets) - p, " %" PRIu32, h.bucket(i));
+		}
+		ESP_LOGI(TAG, "profile %-15s n=%" PRIu32 " mean=%.1fus max=%.1fus |%s", profile::stage_name(static_cast<profile::stage_t>(s)),
+		         h.count(), static_cast<float>(h.total()) / h.count() / per_us, static_cast<float>(h.max()) / per_us, buckets);
+		if (reset) {
+			h.reset();
 		}
 	}
-	if (state_timeout && esphome::millis() - state_started > state_timeout) {
-		ESP_LOGW(TAG, "%s: State timeout, re-run from init", state_name(state));
-		set_state(state_t::init, 0);
+#else
+	(void) reset;
+	ESP_LOGW(TAG, "Profiling is not compiled in, set profile: true");
+#endif
+}
+
+void
+BRoute::log_heap() {
+#ifdef USE_ESP32
+	uint32_t free = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+	uint32_t min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+	if (heap_baseline == 0) {
+		heap_baseline = free;
 	}
+	ESP_LOGD(TAG, "Heap: free %lu, lowest %lu, %ld since first join", free, min_free,
+	         static_cast<int32_t>(free - heap_baseline));
+#endif
+}
+
+void
+BRoute::log_uart_stats() {
+	auto& st = bp.stats();
+	ESP_LOGD(TAG, "UART: %lu B/s, %lu lines, line latency avg %lu us max %lu us, %lu overflows",
+	         static_cast<uint32_t>(st.bytes * 1000ull / UART_STATS_INTERVAL), st.lines,
+	         st.lines ? st.latency_total / st.lines : 0, st.latency_max, st.overflows);
+	bp.reset_stats();
+	ESP_LOGD(TAG, "RXUDP: %lu accepted, rejected by port %lu, header %lu, SEOJ %lu, ESV %lu, properties %lu, malformed %lu",
+	         rx_stats.accepted, rx_stats.port, rx_stats.header, rx_stats.seoj, rx_stats.esv, rx_stats.properties,
+	         rx_stats.malformed);
 }
 
 }  // namespace esphome::b_route
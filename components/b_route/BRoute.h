@@ -2,32 +2,124 @@
 #include <esphome/components/sensor/sensor.h>
 #include <esphome/components/uart/uart.h>
 #include <esphome/core/component.h>
+#include <esphome/core/defines.h>
+#include <esphome/core/helpers.h>
+#include <esphome/core/preferences.h>
+#include <algorithm>
 #include <cmath>
+#include <memory>
 #include "bp35cmd.h"
+#include "demand.h"
 #include "echonet_lite.h"
+#include "energy.h"
 #include "libbp35.h"
+#include "meter_clock.h"
+#include "offline_buffer.h"
+#include "property_cache.h"
+#include "recovery.h"
+#include "stats.h"
+#include "trace.h"
+
+#if defined(USE_B_ROUTE_DEMAND) && !(defined(USE_B_ROUTE_POWER) && defined(USE_B_ROUTE_ENERGY))
+#error "USE_B_ROUTE_DEMAND requires USE_B_ROUTE_POWER and USE_B_ROUTE_ENERGY"
+#endif
+#if defined(USE_B_ROUTE_POWER_STATS) && !defined(USE_B_ROUTE_POWER)
+#error "USE_B_ROUTE_POWER_STATS requires USE_B_ROUTE_POWER"
+#endif
 
 namespace esphome {
 namespace b_route {
 
 using echonet_lite::EOJ;
 
+enum class RecoveryPolicyType { fixed, backoff };
+
+// property declared in the YAML `properties:` list, emitted as a constexpr table sorted by interval
+struct PropertyDef {
+	uint8_t epc;
+	uint8_t size;
+	bool is_signed;
+	float scale;
+	uint32_t interval;
+};
+
 class BRoute : public Component, public uart::UARTDevice, public libbp35::SerialIO {
  public:
 	BRoute();
 	virtual void loop() override;
+#ifdef USE_B_ROUTE_POWER
 	void set_power_sensor(sensor::Sensor* sensor) { power_sensor = sensor; }
-	void set_energy_sensor(sensor::Sensor* sensor) { energy_sensor = sensor; }
 	void set_power_sensor_interval_sec(uint32_t interval) { power_sensor_interval = interval * 1000; }
+#endif
+#ifdef USE_B_ROUTE_ENERGY
+	void set_energy_sensor(sensor::Sensor* sensor) { energy_sensor = sensor; }
 	void set_energy_sensor_interval_sec(uint32_t interval) { energy_sensor_interval = interval * 1000; }
+	void set_energy_slot_aligned(bool aligned) { energy_slot_aligned = aligned; }
+#endif
+#ifdef USE_B_ROUTE_POWER_STATS
+	void set_power_min_sensor(sensor::Sensor* sensor) { power_min_sensor = sensor; }
+	void set_power_max_sensor(sensor::Sensor* sensor) { power_max_sensor = sensor; }
+	void set_power_mean_sensor(sensor::Sensor* sensor) { power_mean_sensor = sensor; }
+	void set_power_p95_sensor(sensor::Sensor* sensor) { power_p95_sensor = sensor; }
+	void set_power_stats_window_sec(uint32_t window) { power_stats_window = window * 1000; }
+#endif
+	void set_link_quality_sensor(sensor::Sensor* sensor) { link_quality_sensor = sensor; }
+#ifdef USE_B_ROUTE_DEMAND
+	void set_demand_sensor(sensor::Sensor* sensor) { demand_sensor = sensor; }
+	void set_demand_threshold(float kw) { demand_threshold = kw; }
+	// called once per 30 min slot when the predicted demand (kW) reaches the threshold
+	void add_on_demand_threshold_callback(std::function<void(float)>&& callback) {
+		demand_threshold_callback.add(std::move(callback));
+	}
+#endif
+	void set_link_quality_threshold(float percent) { link_quality_threshold = percent; }
+#ifdef USE_B_ROUTE_PROPERTIES
+	void set_properties(const PropertyDef* defs, size_t count) {
+		properties = defs;
+		property_count = std::min(count, MAX_CUSTOM_PROPERTIES);
+	}
+	void set_property_sensor(size_t index, sensor::Sensor* sensor) {
+		if (index < MAX_CUSTOM_PROPERTIES) {
+			property_sensors[index] = sensor;
+		}
+	}
+#endif
+	void set_offline_buffer(size_t size, uint32_t flush_interval) {
+		offline_buffer_size = size;
+		offline_flush_interval = flush_interval;
+	}
+	// called per reading taken while the API was disconnected, once it is back: sensor name, value, age in seconds
+	void add_on_replay_callback(std::function<void(std::string, float, uint32_t)>&& callback) {
+		replay_callback.add(std::move(callback));
+	}
 	void set_rejoin_miss_count(uint8_t count) { rejoin_miss_count = count; }
 	void set_rejoin_timeout_sec(uint32_t sec) { rejoin_timeout = sec * 1000; }
 	void set_rescan_timeout_sec(uint32_t sec) { rescan_timeout = sec * 1000; }
+	void set_module_reset_timeout_sec(uint32_t sec) { module_reset_timeout = sec * 1000; }
 	void set_restart_timeout_sec(uint32_t sec) { reboot_timeout = sec * 1000; }
+	void set_recovery_policy(RecoveryPolicyType type) { recovery_policy_type = type; }
+	void set_meter_mac(const char* addr) {
+		std::string_view sv{addr};
+		auto cur = std::cbegin(sv);
+		meter_mac_set = libbp35::cmd::arg::get_mac(cur, std::cend(sv), meter_mac);
+	}
 	void set_rbid(const char* id, const char* password) {
 		rb_id = id;
 		rb_password = password;
 	}
+	// sample momentary power every `interval` ms for `duration` ms, then return to the configured interval
+	void start_burst(uint32_t duration, uint32_t interval);
+	void stop_burst();
+	// log the trace buffer as hex, decode with tools/decode_trace.py
+	void dump_trace() const;
+	// log the per stage timing histograms, optionally starting over
+	void dump_profile(bool reset);
+	// Latest raw value of a meter property, for lambdas and other components.
+	// Returns it if received within max_age ms. Otherwise returns nullptr and requests it, sharing the request with
+	// other consumers; the callback is called with the new value, or nullptr if the meter does not provide it.
+	const property_cache::entry_t* get(uint8_t epc, uint32_t max_age, property_cache::callback_t callback = nullptr);
+	// cached value regardless of its age
+	const property_cache::entry_t* cached(uint8_t epc) const { return value_cache.find(epc); }
 
 	virtual size_t write(char c) override {
 		write_byte(c);
@@ -58,84 +150,314 @@ class BRoute : public Component, public uart::UARTDevice, public libbp35::Serial
  private:
 	static constexpr EOJ EOJ_CONTROLLER{0x05, 0xff, 0x01};
 	static constexpr EOJ EOJ_LOWV_SMART_METER{0x02, 0x88, 0x01};
-	static constexpr uint32_t REQUEST_PROPERTY_INTERVAL = 5'000;
+	static constexpr EOJ EOJ_NODE_PROFILE{0x0e, 0xf0, 0x01};
 	static constexpr const char* TAG = "b_route";
 
-	enum class initial_value_t { pwd, rbid, panid, channel, ropt, wopt, echo } setting_value = initial_value_t::pwd;
-	enum class state_t { init, wait_ver, setting_values, scanning, joining, running, addr_conv, restarting } state = state_t::init;
+	static constexpr size_t SETTINGS_PIPELINE_DEPTH = 4;
+	static constexpr size_t MAX_PANS = 4;
+	static constexpr size_t PAN_BLACKLIST_SIZE = 4;
+	static constexpr size_t REQUEST_QUEUE_SIZE = 6;
+	static constexpr size_t MAX_CUSTOM_PROPERTIES = 16;
+	// reading channels of the offline buffer
+	static constexpr uint8_t CHANNEL_POWER = 0;
+	static constexpr uint8_t CHANNEL_ENERGY = 1;
+	static constexpr uint8_t CHANNEL_PROPERTIES = 2;
+	static_assert(CHANNEL_PROPERTIES + MAX_CUSTOM_PROPERTIES <= offline::ReadingBuffer::MAX_CHANNELS);
+	static constexpr uint8_t APPLIED_ECHO = 0x01;
+	static constexpr uint8_t APPLIED_ASCII = 0x02;
+	static constexpr uint8_t APPLIED_AUTH = 0x04;
+	static constexpr uint8_t APPLIED_ALL = APPLIED_ECHO | APPLIED_ASCII | APPLIED_AUTH;
+
+	enum class initial_value_t { ver, info, pwd, rbid, lifetime, panid, channel, ropt, wopt, echo };
+	enum class state_t { init, wait_ver, setting_values, scanning, joining, running, reauth, addr_conv, resetting, restarting } state = state_t::init;
 
 	libbp35::BP35 bp{*this};
+	// keeps loop() running without the loop interval while a line is being received
+	HighFrequencyLoopRequester line_receiving;
+#ifdef USE_B_ROUTE_POWER
 	sensor::Sensor* power_sensor = nullptr;
+#endif
+#ifdef USE_B_ROUTE_ENERGY
 	sensor::Sensor* energy_sensor = nullptr;
-	std::string v6_address;
-	std::string channel;
-	std::string panid;
-	std::string mac;
+#endif
+#ifdef USE_B_ROUTE_POWER_STATS
+	sensor::Sensor* power_min_sensor = nullptr;
+	sensor::Sensor* power_max_sensor = nullptr;
+	sensor::Sensor* power_mean_sensor = nullptr;
+	sensor::Sensor* power_p95_sensor = nullptr;
+	stats::WindowAggregator power_stats;
+#endif
+	sensor::Sensor* link_quality_sensor = nullptr;
+#ifdef USE_B_ROUTE_DEMAND
+	// predicted demand of the current 30 min slot
+	sensor::Sensor* demand_sensor = nullptr;
+	demand::Tracker demand_tracker;
+	float demand_threshold = 0;
+	int64_t demand_alerted_slot = -1;
+	CallbackManager<void(float)> demand_threshold_callback;
+#endif
+#ifdef USE_B_ROUTE_PROPERTIES
+	const PropertyDef* properties = nullptr;
+	size_t property_count = 0;
+	std::array<sensor::Sensor*, MAX_CUSTOM_PROPERTIES> property_sensors{};
+#endif
+	// readings held while the API is disconnected, replayed in order afterwards
+	offline::ReadingBuffer offline_readings;
+	size_t offline_buffer_size = 0;
+	uint32_t offline_flush_interval = 100;
+	bool offline_buffering = false;
+	CallbackManager<void(std::string, float, uint32_t)> replay_callback;
+	// link quality inputs: signal strength (dBm) and request success ratio
+	stats::Ewma link_rssi{0.2f};
+	stats::Ewma link_success_fast{0.3f};
+	stats::Ewma link_success_slow{0.05f};
+	float link_quality_threshold = 0;
+	uint32_t last_link_action = 0;
+	bool awaiting_response = false;
+	uint8_t send_retries = 0;
+	uint32_t send_failures = 0;  // transmission failed in the module (EVENT 21)
+	uint32_t no_responses = 0;   // sent but meter did not respond
+	// ERXUDP by the decode stage that dropped it, cumulative
+	struct rx_stats_t {
+		uint32_t accepted;
+		uint32_t malformed;
+		uint32_t port;
+		uint32_t header;
+		uint32_t seoj;
+		uint32_t esv;
+		uint32_t properties;
+	} rx_stats{};
+	trace::Buffer trace_buffer;
+	property_cache::Cache value_cache;
+	bool cache_timer_armed = false;
+	// link local address of the selected PAN (SKLL64), channel/PAN ID/MAC are kept in pan_selected
+	uint8_t v6_address[16]{};
+	bool v6_address_set = false;
+	// free heap when running was first entered, to see allocations grow over rejoins
+	uint32_t heap_baseline = 0;
+	// scan results of the current/last active scan
+	std::array<libbp35::pandesc_t, MAX_PANS> pans{};
+	uint8_t pan_count = 0;
+	libbp35::pandesc_t pan_parsing{};
+	libbp35::pandesc_t pan_selected{};
+	struct pan_blacklist_t {
+		uint8_t addr[8];
+		uint32_t since;
+		bool used;
+	};
+	std::array<pan_blacklist_t, PAN_BLACKLIST_SIZE> pan_blacklist{};
+	uint8_t meter_mac[8]{};
+	bool meter_mac_set = false;
 	const char* rb_password = nullptr;
 	const char* rb_id = nullptr;
 
-	int32_t energy_coeff = -1;
-	float energy_unit = NAN;
+	// commands sent but not yet acknowledged, in order
+	std::array<initial_value_t, SETTINGS_PIPELINE_DEPTH> settings_pipeline{};
+	uint8_t settings_sent = 0;
+	uint8_t settings_acked = 0;
+	// module settings known to be applied since the last module reset
+	uint8_t settings_applied = 0;
+	bool info_matched = false;
+	uint32_t init_started = 0;
+	uint32_t session_expired_at = 0;
+	uint32_t session_lifetime = 0;
+	bool reauth_pending = false;
+
+#ifdef USE_B_ROUTE_ENERGY
+	energy::Scale energy_scale;
+	uint32_t last_energy_counter = 0;
+#endif
+	// pending Get requests, one of them is on air at a time
+	struct request_t {
+		std::array<uint8_t, echonet_lite::MAX_PROPERTIES> epcs;
+		uint8_t count;
+		uint8_t priority;  // larger is sent first
+		uint8_t attempts;
+		uint32_t enqueued;
+		uint32_t max_age;  // dropped if not sent within, 0 never expires
+		bool node_profile;  // sent to the node profile instead of the meter
+		bool used;
+	};
+	std::array<request_t, REQUEST_QUEUE_SIZE> request_queue{};
+	request_t* inflight = nullptr;
+	uint16_t inflight_tid = 0;
+	uint16_t next_tid = 0;
+	uint32_t requests_dropped = 0;
 	uint32_t property_requested = 0;
-	uint32_t state_timeout = 0;
-	uint32_t state_started = 0;
-	uint32_t rejoin_timer = 0;
-	uint32_t rescan_timer = 0;
-	uint32_t reboot_timer = 0;
+	uint32_t request_done = 0;
 	uint8_t miss_count = 0;
+#ifdef USE_B_ROUTE_POWER
 	uint32_t power_sensor_interval = 30'000;
+#endif
+	bool burst_active = false;
+	// transmit time limit (EVENT 32) in effect, no burst until cleared (EVENT 33)
+	bool tx_limited = false;
+#ifdef USE_B_ROUTE_ENERGY
 	uint32_t energy_sensor_interval = 60'000;
+	bool energy_slot_aligned = false;
+	// only energy slot alignment and demand need the meter clock
+	meter_clock::Clock meter_time;
+#endif
+	// Get property map of the joined meter, cached in flash per meter address
+	echonet_lite::PropertyMap property_map{};
+	bool property_map_known = false;
+	uint32_t property_map_key = 0;
+	ESPPreferenceObject property_map_pref;
+	// meter instance from the node profile instance list, cached in flash per meter address
+	EOJ meter_eoj = EOJ_LOWV_SMART_METER;
+	bool meter_eoj_known = false;
+	uint32_t meter_eoj_key = 0;
+	ESPPreferenceObject meter_eoj_pref;
+#ifdef USE_B_ROUTE_POWER_STATS
+	uint32_t power_stats_window = 0;
+#endif
 	uint32_t rejoin_timeout = 0;
 	uint32_t rescan_timeout = 0;
+	uint32_t module_reset_timeout = 0;
 	uint32_t reboot_timeout = 0;
 	uint8_t rejoin_miss_count = 0;
 
+	RecoveryPolicyType recovery_policy_type = RecoveryPolicyType::fixed;
+	std::unique_ptr<recovery::Policy> recovery_policy;
+	uint32_t recovery_step = 0;
+	uint32_t recovery_started = 0;
+	uint32_t last_data_received = 0;
+	uint8_t module_unresponsive = 0;
+	bool module_reset_tried = false;
+	struct {
+		uint32_t rejoins;
+		uint32_t rescans;
+		uint32_t module_resets;
+		uint32_t reboots;
+		uint32_t recoveries;
+		uint32_t recovery_time_total;
+	} recovery_counters{};
+
+	struct transition_t {
+		state_t state;
+		libbp35::event_t ev;
+		uint8_t event_num;  // EVENT number to match, 0 matches any
+		void (BRoute::*action)(const libbp35::event_params_t&);
+	};
+	static const transition_t TRANSITIONS[];
+
 	void set_state(state_t state, uint32_t timeout);
+	void dispatch(libbp35::event_t ev, const libbp35::event_params_t& params);
+	void start_init();
+	void send_setting(initial_value_t value);
+	bool next_setting_ack(initial_value_t& value);
 	void start_join();
 	void start_scan();
 	void handle_rxudp(std::string_view);
 	void handle_property_response(const std::byte* data, const echonet_lite::Packet& pkt);
+#ifdef USE_B_ROUTE_POWER
 	void request_momentary_power();
+#endif
+#ifdef USE_B_ROUTE_ENERGY
 	void request_integral_energy();
 	void request_energy_parameters();
-	bool test_nw_info() const;
-	bool energy_params_received() const { return std::isfinite(energy_unit) && energy_coeff > 0; }
+	void request_meter_clock();
+	void schedule_energy();
+	void handle_meter_clock(const meter_clock::datetime_t& dt);
+	bool energy_params_received() const { return energy_scale.ready(); }
+	void apply_energy_scale();
+#endif
+#ifdef USE_B_ROUTE_PROPERTIES
+	void request_properties(size_t begin, size_t end);
+	bool handle_custom_property(const std::byte* raw, const echonet_lite::Property& prop);
+#endif
+	void load_property_map();
+	void load_meter_eoj();
+	void handle_node_profile(const std::byte* raw, const echonet_lite::Packet& pkt);
+	void update_cache(const std::byte* raw, const echonet_lite::Packet& pkt);
+	void expire_cache_waiters();
+	void apply_property_map();
+	bool property_supported(uint8_t epc) const { return !property_map_known || property_map.has(epc); }
+	size_t filter_supported(uint8_t* epcs, size_t count) const;
+#ifdef USE_B_ROUTE_POWER_STATS
+	void publish_power_stats();
+	bool power_stats_enabled() const {
+		return power_stats_window && (power_min_sensor || power_max_sensor || power_mean_sensor || power_p95_sensor);
+	}
+#endif
+#ifdef USE_B_ROUTE_DEMAND
+	void update_demand();
+#endif
+	void publish_reading(uint8_t channel, uint32_t raw);
+	void flush_offline_readings();
+	float reading_value(uint8_t channel, uint32_t raw) const;
+	sensor::Sensor* reading_sensor(uint8_t channel) const;
+	bool api_connected() const;
+	void record_link_result(bool success);
+	float link_quality(const stats::Ewma& success) const;
+	void check_link_quality();
+	void publish_link_quality();
+	void log_uart_stats();
+	void log_heap();
+	void record_trace(trace::kind_t kind, uint8_t code, uint8_t aux = 0, uint16_t tid = 0, uint16_t value = 0) {
+		trace_buffer.add(esphome::millis(), kind, static_cast<uint8_t>(state), code, aux, tid, value);
+	}
+	void commit_pan();
+	bool select_pan();
+	void blacklist_pan(const uint8_t (&addr)[8]);
+	bool is_pan_blacklisted(const uint8_t (&addr)[8]) const;
 	libbp35::event_t get_event(libbp35::event_params_t& params);
 	virtual void setup() override;
 	std::array<std::byte, 255> out_buffer{};
 	bool is_measurement_requesting() const {
-		return (power_sensor && power_sensor_interval > 0 && power_sensor_interval != esphome::SCHEDULER_DONT_RUN) ||
-		       (energy_sensor && energy_sensor_interval > 0 && energy_sensor_interval != esphome::SCHEDULER_DONT_RUN);
+#ifdef USE_B_ROUTE_POWER
+		if (power_sensor && power_sensor_interval > 0 && power_sensor_interval != esphome::SCHEDULER_DONT_RUN) {
+			return true;
+		}
+#endif
+#ifdef USE_B_ROUTE_ENERGY
+		if (energy_sensor && energy_sensor_interval > 0 && energy_sensor_interval != esphome::SCHEDULER_DONT_RUN) {
+			return true;
+		}
+#endif
+		return false;
 	}
-	void reset_timers() { rejoin_timer = rescan_timer = reboot_timer = esphome::millis(); }
+	void reset_timers();
+	void arm_recovery_timer();
+	void perform_recovery(recovery::action_t action);
+	void reset_module();
+
+	void on_state_timeout();
+	void on_recovery_deadline(recovery::action_t action);
+	void on_version(const libbp35::event_params_t&);
+	void on_version_ok(const libbp35::event_params_t&);
+	void on_setting_ok(const libbp35::event_params_t&);
+	void on_info(const libbp35::event_params_t&);
+	void on_scan_ok(const libbp35::event_params_t&);
+	void on_scan_line(const libbp35::event_params_t&);
+	void on_scan_done(const libbp35::event_params_t&);
+	void on_pandesc(const libbp35::event_params_t&);
+	void on_addr_line(const libbp35::event_params_t&);
+	void on_join_ok(const libbp35::event_params_t&);
+	void on_joined(const libbp35::event_params_t&);
+	void on_join_failed(const libbp35::event_params_t&);
+	void on_limit_rate(const libbp35::event_params_t&);
+	void on_limit_canceled(const libbp35::event_params_t&);
+	void on_session_expired(const libbp35::event_params_t&);
+	void on_session_lifetime(const libbp35::event_params_t&);
+	void on_reauth_ok(const libbp35::event_params_t&);
+	void on_reauth_timer();
+	void start_reauth();
+	void on_rxudp(const libbp35::event_params_t&);
+	void on_sent_udp(const libbp35::event_params_t&);
+	void on_ignore(const libbp35::event_params_t&);
 
 	template <size_t N>
-	bool request_property(std::array<uint8_t, N> props) {
-		using namespace libbp35::cmd;
-		namespace echo = echonet_lite;
-		if (state != state_t::running) {
-			return false;
-		}
-		if (rejoin_miss_count && miss_count >= rejoin_miss_count) {
-			ESP_LOGW(TAG, "Data not received for %u times, rejoin to meter", miss_count);
-			miss_count = 0;
-			start_join();
-			return false;
-		}
-		if (property_requested && millis() - property_requested < REQUEST_PROPERTY_INTERVAL) {
-			return false;
-		}
-		size_t len = echo::Codec::encode_property_get(out_buffer, EOJ_CONTROLLER, EOJ_LOWV_SMART_METER, props);
-		if (len > std::size(out_buffer)) {
-			ESP_LOGE(TAG, "Get property encode overflow");
-			return false;
-		}
-		bp.send_sk_with_data("SKSENDTO", out_buffer.data(), len, arg::mode(1), arg::str(v6_address), arg::num16(echo::UDP_PORT),
-		                     arg::mode(2), arg::num16(len));
-		property_requested = millis();
-		++miss_count;
-		return true;
+	void enqueue_request(const std::array<uint8_t, N>& props, uint8_t priority, uint32_t max_age, bool node_profile = false) {
+		static_assert(N <= echonet_lite::MAX_PROPERTIES);
+		enqueue_request(props.data(), N, priority, max_age, node_profile);
 	}
+	void enqueue_request(const uint8_t* props, size_t count, uint8_t priority, uint32_t max_age, bool node_profile = false);
+	void pump_requests();
+	void complete_request();
+	void drop_inflight();
+	bool send_property_get(const uint8_t* props, size_t count, uint16_t tid, bool node_profile);
+	void resend_inflight();
 
 	static const char* state_name(state_t);
 };
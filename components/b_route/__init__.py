@@ -1,12 +1,19 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
+from esphome import automation
 from esphome.components import sensor, uart
 from esphome.const import (
+    CONF_DURATION,
     CONF_ID,
+    CONF_INTERVAL,
     CONF_PASSWORD,
     CONF_POWER,
+    CONF_THRESHOLD,
+    CONF_TRIGGER_ID,
     CONF_ENERGY,
     CONF_UPDATE_INTERVAL,
+    UNIT_PERCENT,
+    UNIT_KILOWATT,
     UNIT_WATT,
     UNIT_KILOWATT_HOURS,
     DEVICE_CLASS_POWER,
@@ -23,10 +30,130 @@ CONF_RBID = "rbid"
 CONF_REJOIN_COUNT = "rejoin_count"
 CONF_REJOIN_TIMEOUT = "rejoin_timeout"
 CONF_RESCAN_TIMEOUT = "rescan_timeout"
+CONF_MODULE_RESET_TIMEOUT = "module_reset_timeout"
 CONF_RESTART_TIMEOUT = "restart_timeout"
+CONF_RECOVERY_POLICY = "recovery_policy"
+CONF_METER_MAC = "meter_mac"
+CONF_LINK_QUALITY = "link_quality"
+CONF_LINK_QUALITY_THRESHOLD = "link_quality_threshold"
+CONF_POWER_STATS = "power_stats"
+CONF_WINDOW = "window"
+CONF_MIN = "min"
+CONF_MAX = "max"
+CONF_MEAN = "mean"
+CONF_P95 = "p95"
+CONF_SLOT_ALIGNED = "slot_aligned"
+CONF_PROPERTIES = "properties"
+CONF_EPC = "epc"
+CONF_SIZE = "size"
+CONF_SIGNED = "signed"
+CONF_SCALE = "scale"
+MAX_CUSTOM_PROPERTIES = 16
+# decoded by the component itself, responses for them never reach the custom property sensors
+RESERVED_EPCS = {
+    0x97: "current time",
+    0x98: "current date",
+    0x9F: "Get property map",
+    0xD3: "coefficient",
+    0xE0: "integral energy",
+    0xE1: "energy unit",
+    0xE7: "momentary power",
+    0xEA: "scheduled integral energy",
+}
+CONF_OFFLINE_BUFFER = "offline_buffer"
+CONF_BUFFER_SIZE = "buffer_size"
+CONF_FLUSH_INTERVAL = "flush_interval"
+CONF_ON_REPLAY = "on_replay"
+CONF_DEMAND = "demand"
+CONF_ON_THRESHOLD = "on_threshold"
+CONF_PROFILE = "profile"
+CONF_RESET = "reset"
+POWER_STATS_SENSORS = [CONF_MIN, CONF_MAX, CONF_MEAN, CONF_P95]
 
 b_route_ns = cg.esphome_ns.namespace("b_route")
 BRouteComponent = b_route_ns.class_("BRoute", cg.Component, uart.UARTDevice)
+RecoveryPolicyType = b_route_ns.enum("RecoveryPolicyType", is_class=True)
+PropertyDef = b_route_ns.struct("PropertyDef")
+BurstAction = b_route_ns.class_("BurstAction", automation.Action)
+DumpTraceAction = b_route_ns.class_("DumpTraceAction", automation.Action)
+DumpProfileAction = b_route_ns.class_("DumpProfileAction", automation.Action)
+DemandThresholdTrigger = b_route_ns.class_("DemandThresholdTrigger", automation.Trigger.template(cg.float_))
+ReplayTrigger = b_route_ns.class_("ReplayTrigger", automation.Trigger.template(cg.std_string, cg.float_, cg.uint32))
+RECOVERY_POLICIES = {
+    "fixed": RecoveryPolicyType.fixed,
+    "backoff": RecoveryPolicyType.backoff,
+}
+
+POWER_SENSOR_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_WATT,
+    device_class=DEVICE_CLASS_POWER,
+    state_class=STATE_CLASS_MEASUREMENT,
+    accuracy_decimals=0,
+)
+
+PROPERTY_SCHEMA = sensor.sensor_schema().extend(
+    {
+        cv.Required(CONF_EPC): cv.hex_int_range(min=0x80, max=0xFF),
+        cv.Optional(CONF_SIZE, default=4): cv.one_of(1, 2, 4, int=True),
+        cv.Optional(CONF_SIGNED, default=False): cv.boolean,
+        cv.Optional(CONF_SCALE, default=1.0): cv.float_,
+        cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_seconds,
+    }
+)
+
+
+def validate_properties(value):
+    epcs = [p[CONF_EPC] for p in value]
+    for epc in epcs:
+        if epc in RESERVED_EPCS:
+            raise cv.Invalid(f"epc 0x{epc:02X} ({RESERVED_EPCS[epc]}) is handled by b_route and cannot be a property")
+    if len(set(epcs)) != len(epcs):
+        raise cv.Invalid("Duplicate epc in properties")
+    return value
+
+
+def validate_meter_mac(value):
+    value = cv.string_strict(value).replace(":", "").upper()
+    if len(value) != 16 or any(c not in "0123456789ABCDEF" for c in value):
+        raise cv.Invalid("Meter MAC address must be 16 hex digits (64bit)")
+    return value
+
+
+def validate_power_stats(config):
+    if CONF_POWER_STATS in config and CONF_POWER not in config:
+        raise cv.Invalid(f"'{CONF_POWER_STATS}' requires '{CONF_POWER}'")
+    return config
+
+
+def validate_demand(config):
+    if CONF_DEMAND in config and (CONF_POWER not in config or CONF_ENERGY not in config):
+        raise cv.Invalid(f"'{CONF_DEMAND}' requires '{CONF_POWER}' and '{CONF_ENERGY}'")
+    return config
+
+
+# only the fixed policy has a step per timeout, backoff derives its delays from rejoin_timeout
+FIXED_RECOVERY_TIMEOUTS = {
+    CONF_RESCAN_TIMEOUT: "240s",
+    CONF_MODULE_RESET_TIMEOUT: "300s",
+    CONF_RESTART_TIMEOUT: "0s",
+}
+
+
+def validate_recovery_policy(config):
+    for key, default in FIXED_RECOVERY_TIMEOUTS.items():
+        if key in config:
+            if config[CONF_RECOVERY_POLICY] == "backoff":
+                raise cv.Invalid(f"'{key}' is not used by '{CONF_RECOVERY_POLICY}: backoff'", path=[key])
+        else:
+            config[key] = cv.positive_time_period_seconds(default)
+    return config
+
+
+def validate_demand_threshold(config):
+    if CONF_ON_THRESHOLD in config and CONF_THRESHOLD not in config:
+        raise cv.Invalid(f"'{CONF_ON_THRESHOLD}' requires '{CONF_THRESHOLD}'")
+    return config
+
 
 CONFIG_SCHEMA = (
     cv.Schema(
@@ -34,26 +161,80 @@ CONFIG_SCHEMA = (
             cv.GenerateID(): cv.declare_id(BRouteComponent),
             cv.Required(CONF_RBID): cv.All(cv.string_strict, cv.Length(min=32, max=32)),
             cv.Required(CONF_PASSWORD): cv.All(cv.string_strict, cv.Length(min=1, max=32)),
-            cv.Optional(CONF_POWER): sensor.sensor_schema(
-                unit_of_measurement=UNIT_WATT,
-                device_class=DEVICE_CLASS_POWER,
-                state_class=STATE_CLASS_MEASUREMENT,
-                accuracy_decimals=0,
-            ).extend({cv.Optional(CONF_UPDATE_INTERVAL, default="30s"): cv.positive_time_period_seconds}),
+            cv.Optional(CONF_METER_MAC): validate_meter_mac,
+            cv.Optional(CONF_POWER): POWER_SENSOR_SCHEMA.extend(
+                {cv.Optional(CONF_UPDATE_INTERVAL, default="30s"): cv.positive_time_period_seconds}
+            ),
+            cv.Optional(CONF_POWER_STATS): cv.All(
+                cv.Schema(
+                    {
+                        cv.Optional(CONF_WINDOW, default="60s"): cv.positive_time_period_seconds,
+                        **{cv.Optional(k): POWER_SENSOR_SCHEMA for k in POWER_STATS_SENSORS},
+                    }
+                ),
+                cv.has_at_least_one_key(*POWER_STATS_SENSORS),
+            ),
             cv.Optional(CONF_ENERGY): sensor.sensor_schema(
                 unit_of_measurement=UNIT_KILOWATT_HOURS,
                 device_class=DEVICE_CLASS_ENERGY,
                 state_class=STATE_CLASS_TOTAL_INCREASING,
                 accuracy_decimals=1,
-            ).extend({cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_seconds}),
+            ).extend(
+                {
+                    cv.Optional(CONF_UPDATE_INTERVAL, default="60s"): cv.positive_time_period_seconds,
+                    cv.Optional(CONF_SLOT_ALIGNED, default=False): cv.boolean,
+                }
+            ),
+            cv.Optional(CONF_PROPERTIES): cv.All(
+                cv.ensure_list(PROPERTY_SCHEMA), cv.Length(min=1, max=MAX_CUSTOM_PROPERTIES), validate_properties
+            ),
+            cv.Optional(CONF_OFFLINE_BUFFER): cv.Schema(
+                {
+                    cv.Optional(CONF_BUFFER_SIZE, default=1024): cv.int_range(min=64, max=65536),
+                    cv.Optional(CONF_FLUSH_INTERVAL, default="100ms"): cv.positive_time_period_milliseconds,
+                    # buffered readings only leave the device through this trigger
+                    cv.Required(CONF_ON_REPLAY): automation.validate_automation(
+                        {cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(ReplayTrigger)}
+                    ),
+                }
+            ),
+            cv.Optional(CONF_DEMAND): cv.All(
+                sensor.sensor_schema(
+                    unit_of_measurement=UNIT_KILOWATT,
+                    device_class=DEVICE_CLASS_POWER,
+                    state_class=STATE_CLASS_MEASUREMENT,
+                    accuracy_decimals=2,
+                ).extend(
+                    {
+                        cv.Optional(CONF_THRESHOLD): cv.positive_float,
+                        cv.Optional(CONF_ON_THRESHOLD): automation.validate_automation(
+                            {cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(DemandThresholdTrigger)}
+                        ),
+                    }
+                ),
+                validate_demand_threshold,
+            ),
+            cv.Optional(CONF_LINK_QUALITY): sensor.sensor_schema(
+                unit_of_measurement=UNIT_PERCENT,
+                state_class=STATE_CLASS_MEASUREMENT,
+                accuracy_decimals=0,
+                icon="mdi:signal",
+            ),
+            cv.Optional(CONF_LINK_QUALITY_THRESHOLD, default="0%"): cv.percentage,
             cv.Optional(CONF_REJOIN_COUNT, default=10): cv.int_range(min=0, max=127),
             cv.Optional(CONF_REJOIN_TIMEOUT, default="120s"): cv.positive_time_period_seconds,
-            cv.Optional(CONF_RESCAN_TIMEOUT, default="240s"): cv.positive_time_period_seconds,
-            cv.Optional(CONF_RESTART_TIMEOUT, default="360s"): cv.positive_time_period_seconds,
+            cv.Optional(CONF_RESCAN_TIMEOUT): cv.positive_time_period_seconds,
+            cv.Optional(CONF_MODULE_RESET_TIMEOUT): cv.positive_time_period_seconds,
+            cv.Optional(CONF_RESTART_TIMEOUT): cv.positive_time_period_seconds,
+            cv.Optional(CONF_RECOVERY_POLICY, default="fixed"): cv.enum(RECOVERY_POLICIES, lower=True),
+            cv.Optional(CONF_PROFILE, default=False): cv.boolean,
         }
     )
     .extend(uart.UART_DEVICE_SCHEMA)
     .extend(cv.COMPONENT_SCHEMA)
+    .add_extra(validate_power_stats)
+    .add_extra(validate_demand)
+    .add_extra(validate_recovery_policy)
 )
 
 
@@ -62,15 +243,121 @@ async def to_code(config):
     await cg.register_component(var, config)
     await uart.register_uart_device(var, config)
     cg.add(var.set_rbid(config[CONF_RBID], config[CONF_PASSWORD]))
+    if CONF_METER_MAC in config:
+        cg.add(var.set_meter_mac(config[CONF_METER_MAC]))
     cg.add(var.set_rejoin_miss_count(config[CONF_REJOIN_COUNT]))
     cg.add(var.set_rejoin_timeout_sec(config[CONF_REJOIN_TIMEOUT]))
     cg.add(var.set_rescan_timeout_sec(config[CONF_RESCAN_TIMEOUT]))
+    cg.add(var.set_module_reset_timeout_sec(config[CONF_MODULE_RESET_TIMEOUT]))
     cg.add(var.set_restart_timeout_sec(config[CONF_RESTART_TIMEOUT]))
+    cg.add(var.set_recovery_policy(config[CONF_RECOVERY_POLICY]))
+    cg.add(var.set_link_quality_threshold(config[CONF_LINK_QUALITY_THRESHOLD] * 100))
+    if config[CONF_PROFILE]:
+        cg.add_define("USE_B_ROUTE_PROFILE")
+    if c := config.get(CONF_OFFLINE_BUFFER):
+        cg.add(var.set_offline_buffer(c[CONF_BUFFER_SIZE], c[CONF_FLUSH_INTERVAL]))
+        for conf in c[CONF_ON_REPLAY]:
+            trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+            await automation.build_automation(
+                trigger, [(cg.std_string, "name"), (cg.float_, "value"), (cg.uint32, "age")], conf
+            )
+    if c := config.get(CONF_LINK_QUALITY):
+        s = await sensor.new_sensor(c)
+        cg.add(var.set_link_quality_sensor(s))
+    # only the configured features are compiled in, shared by all instances
     if c := config.get(CONF_POWER):
+        cg.add_define("USE_B_ROUTE_POWER")
         s = await sensor.new_sensor(c)
         cg.add(var.set_power_sensor(s))
         cg.add(var.set_power_sensor_interval_sec(c[CONF_UPDATE_INTERVAL]))
     if c := config.get(CONF_ENERGY):
+        cg.add_define("USE_B_ROUTE_ENERGY")
         s = await sensor.new_sensor(c)
         cg.add(var.set_energy_sensor(s))
         cg.add(var.set_energy_sensor_interval_sec(c[CONF_UPDATE_INTERVAL]))
+        cg.add(var.set_energy_slot_aligned(c[CONF_SLOT_ALIGNED]))
+    if c := config.get(CONF_DEMAND):
+        cg.add_define("USE_B_ROUTE_DEMAND")
+        s = await sensor.new_sensor(c)
+        cg.add(var.set_demand_sensor(s))
+        if CONF_THRESHOLD in c:
+            cg.add(var.set_demand_threshold(c[CONF_THRESHOLD]))
+        for conf in c.get(CONF_ON_THRESHOLD, []):
+            trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+            await automation.build_automation(trigger, [(cg.float_, "x")], conf)
+    if c := config.get(CONF_POWER_STATS):
+        cg.add_define("USE_B_ROUTE_POWER_STATS")
+        cg.add(var.set_power_stats_window_sec(c[CONF_WINDOW]))
+        for k in POWER_STATS_SENSORS:
+            if sc := c.get(k):
+                s = await sensor.new_sensor(sc)
+                cg.add(getattr(var, f"set_power_{k}_sensor")(s))
+    if props := config.get(CONF_PROPERTIES):
+        cg.add_define("USE_B_ROUTE_PROPERTIES")
+        # sorted by interval so that properties of the same interval are requested together
+        props = sorted(props, key=lambda p: p[CONF_UPDATE_INTERVAL].total_milliseconds)
+        table = f"{config[CONF_ID].id}_properties"
+        entries = ", ".join(
+            f"{{0x{p[CONF_EPC]:02X}, {p[CONF_SIZE]}, {str(p[CONF_SIGNED]).lower()}, {p[CONF_SCALE]!r}f, "
+            f"{int(p[CONF_UPDATE_INTERVAL].total_milliseconds)}}}"
+            for p in props
+        )
+        cg.add_global(cg.RawStatement(f"static constexpr {PropertyDef} {table}[] = {{{entries}}};"))
+        cg.add(var.set_properties(cg.RawExpression(table), len(props)))
+        for i, p in enumerate(props):
+            s = await sensor.new_sensor(p)
+            cg.add(var.set_property_sensor(i, s))
+
+
+@automation.register_action(
+    "b_route.burst",
+    BurstAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(BRouteComponent),
+            cv.Optional(CONF_DURATION, default="60s"): cv.templatable(
+                cv.All(cv.positive_time_period_milliseconds, cv.Range(max=cv.TimePeriod(minutes=10)))
+            ),
+            cv.Optional(CONF_INTERVAL, default="2s"): cv.templatable(
+                cv.All(cv.positive_time_period_milliseconds, cv.Range(min=cv.TimePeriod(milliseconds=500)))
+            ),
+        }
+    ),
+)
+async def burst_action_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    duration = await cg.templatable(config[CONF_DURATION], args, cg.uint32)
+    cg.add(var.set_duration(duration))
+    interval = await cg.templatable(config[CONF_INTERVAL], args, cg.uint32)
+    cg.add(var.set_interval(interval))
+    return var
+
+
+@automation.register_action(
+    "b_route.dump_trace",
+    DumpTraceAction,
+    automation.maybe_simple_id({cv.GenerateID(): cv.use_id(BRouteComponent)}),
+)
+async def dump_trace_action_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+
+@automation.register_action(
+    "b_route.dump_profile",
+    DumpProfileAction,
+    automation.maybe_simple_id(
+        {
+            cv.GenerateID(): cv.use_id(BRouteComponent),
+            cv.Optional(CONF_RESET, default=False): cv.templatable(cv.boolean),
+        }
+    ),
+)
+async def dump_profile_action_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    reset = await cg.templatable(config[CONF_RESET], args, bool)
+    cg.add(var.set_reset(reset))
+    return var
@@ -0,0 +1,47 @@
+#pragma once
+#include <esphome/core/automation.h>
+#include "BRoute.h"
+
+namespace esphome::b_route {
+
+template <typename... Ts>
+class BurstAction : public Action<Ts...>, public Parented<BRoute> {
+ public:
+	TEMPLATABLE_VALUE(uint32_t, duration)
+	TEMPLATABLE_VALUE(uint32_t, interval)
+
+	void play(Ts... x) override { this->parent_->start_burst(this->duration_.value(x...), this->interval_.value(x...)); }
+};
+
+#ifdef USE_B_ROUTE_DEMAND
+class DemandThresholdTrigger : public Trigger<float> {
+ public:
+	explicit DemandThresholdTrigger(BRoute* parent) {
+		parent->add_on_demand_threshold_callback([this](float demand) { this->trigger(demand); });
+	}
+};
+#endif
+
+class ReplayTrigger : public Trigger<std::string, float, uint32_t> {
+ public:
+	explicit ReplayTrigger(BRoute* parent) {
+		parent->add_on_replay_callback(
+		    [this](std::string name, float value, uint32_t age) { this->trigger(name, value, age); });
+	}
+};
+
+template <typename... Ts>
+class DumpTraceAction : public Action<Ts...>, public Parented<BRoute> {
+ public:
+	void play(Ts... x) override { this->parent_->dump_trace(); }
+};
+
+template <typename... Ts>
+class DumpProfileAction : public Action<Ts...>, public Parented<BRoute> {
+ public:
+	TEMPLATABLE_VALUE(bool, reset)
+
+	void play(Ts... x) override { this->parent_->dump_profile(this->reset_.value(x...)); }
+};
+
+}  // namespace esphome::b_route
@@ -1,5 +1,4 @@
 #include "bp35cmd.h"
-#include <string>
 
 namespace libbp35::cmd::arg {
 
@@ -22,52 +21,79 @@ hexvalue(char c) {
 	return -1;
 }
 
-std::string
+namespace {
+
+void
+put_hex(char* out, uint32_t v, int digits) {
+	for (int i = digits - 1; i >= 0; i--, v >>= 4) {
+		out[i] = hexchar(v & 0x0f);
+	}
+}
+
+}  // namespace
+
+text<1>
 nibble(uint8_t b) {
 	return {hexchar(b)};
 }
 
-std::string
+text<1>
 flag(bool b) {
-	return b ? "1" : "0";
+	return {b ? '1' : '0'};
 }
 
-std::string
+text<1>
 mode(uint8_t mode) {
 	return nibble(mode & 0x0f);
 }
 
-std::string
+text<2>
 num8(uint8_t n) {
-	return nibble(n >> 4) + nibble(n & 0x0f);
+	text<2> t;
+	put_hex(t.buf.data(), n, 2);
+	return t;
 }
 
-std::string
+text<4>
 num16(uint16_t n) {
-	return num8(n >> 8) + num8(n & 0xff);
+	text<4> t;
+	put_hex(t.buf.data(), n, 4);
+	return t;
 }
 
-std::string
+text<8>
 num32(uint32_t n) {
-	return num16(n >> 16) + num16(n & 0xffff);
+	text<8> t;
+	put_hex(t.buf.data(), n, 8);
+	return t;
 }
 
-std::string
+text<3>
 reg(uint8_t num) {
-	return "S" + num8(num);
+	text<3> t{{'S'}};
+	put_hex(t.buf.data() + 1, num, 2);
+	return t;
 }
 
-std::string
-ipv6(uint8_t (&addr)[16]) {
-	return num16((addr[0] << 8) + addr[1]) + ':' + num16((addr[2] << 8) + addr[3]) + ':' + num16((addr[4] << 8) + addr[5]) + ':' +
-	       num16((addr[6] << 8) + addr[7]) + ':' + num16((addr[8] << 8) + addr[9]) + ':' + num16((addr[10] << 8) + addr[11]) + ':' +
-	       num16((addr[12] << 8) + addr[13]) + ':' + num16((addr[14] << 8) + addr[15]);
+text<39>
+ipv6(const uint8_t (&addr)[16]) {
+	text<39> t;
+	for (int i = 0; i < 8; i++) {
+		put_hex(t.buf.data() + i * 5, (addr[i * 2] << 8) + addr[i * 2 + 1], 4);
+		if (i != 7) {
+			t.buf[i * 5 + 4] = ':';
+		}
+	}
+	return t;
 }
 
-std::string
-mac(uint8_t (&addr)[8]) {
-	return num32((addr[0] << 24) + (addr[1] << 16) + (addr[2] << 8) + addr[3]) +
-	       num32((addr[4] << 24) + (addr[5] << 16) + (addr[6] << 8) + addr[7]);
+text<16>
+mac(const uint8_t (&addr)[8]) {
+	text<16> t;
+	for (int i = 0; i < 8; i++) {
+		put_hex(t.buf.data() + i * 2, addr[i], 2);
+	}
+	return t;
 }
 
 }  // namespace libbp35::cmd::arg
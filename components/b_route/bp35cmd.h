@@ -1,20 +1,32 @@
 #pragma once
-#include <string>
+#include <array>
+#include <cstdint>
+#include <string_view>
 #include <type_traits>
 
 namespace libbp35::cmd::arg {
 
+// formatted argument of a fixed length, null terminated
+template <size_t N>
+struct text {
+	std::array<char, N + 1> buf{};
+	const char* data() const { return buf.data(); }
+	const char* c_str() const { return buf.data(); }
+	static constexpr size_t size() { return N; }
+	operator std::string_view() const { return {buf.data(), N}; }
+};
+
 char hexchar(uint8_t nibble);
 int hexvalue(char c);
-std::string nibble(uint8_t b);
-std::string flag(bool b);
-std::string mode(uint8_t mode);
-std::string num8(uint8_t n);
-std::string num16(uint16_t n);
-std::string num32(uint32_t n);
-std::string reg(uint8_t num);
-std::string ipv6(uint8_t (&addr)[16]);
-std::string mac(uint8_t (&addr)[8]);
+text<1> nibble(uint8_t b);
+text<1> flag(bool b);
+text<1> mode(uint8_t mode);
+text<2> num8(uint8_t n);
+text<4> num16(uint16_t n);
+text<8> num32(uint32_t n);
+text<3> reg(uint8_t num);
+text<39> ipv6(const uint8_t (&addr)[16]);
+text<16> mac(const uint8_t (&addr)[8]);
 inline std::string_view
 str(std::string_view s) {
 	return s;
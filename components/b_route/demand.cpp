@@ -0,0 +1,81 @@
+#include "demand.h"
+#include <algorithm>
+#include <cmath>
+
+namespace demand {
+
+namespace {
+
+constexpr double MS_PER_HOUR = 3'600'000;
+
+int64_t
+slot_of(int64_t t) {
+	return t >= 0 ? t / Tracker::SLOT : (t - Tracker::SLOT + 1) / Tracker::SLOT;
+}
+
+}  // namespace
+
+double
+Tracker::held(int64_t t) const {
+	if (!power_valid) {
+		return 0;
+	}
+	return power * (t - std::max(power_t, anchor_t)) / MS_PER_HOUR;
+}
+
+void
+Tracker::roll(int64_t t) {
+	auto s = slot_of(t);
+	if (s == current) {
+		return;
+	}
+	auto start = s * SLOT;
+	if (s == current + 1) {
+		auto used = consumed(start);
+		last = static_cast<float>(used * MS_PER_HOUR / SLOT);
+		base += used;
+	} else {
+		// first sample, a gap or the clock moved back
+		last = NAN;
+		base_valid = false;
+		power_valid = false;
+	}
+	current = s;
+	consumed_at_anchor = 0;
+	anchor_t = start;
+	integrated = 0;
+}
+
+void
+Tracker::add_energy(int64_t t, double kwh, double resolution) {
+	roll(t);
+	if (!base_valid) {
+		base = kwh + resolution / 2 - consumed(t);
+		base_valid = true;
+	}
+	// the counter reading bounds the energy to [kwh, kwh + resolution)
+	consumed_at_anchor = std::max(std::clamp(consumed(t), kwh - base, kwh + resolution - base), 0.0);
+	anchor_t = t;
+	integrated = 0;
+}
+
+void
+Tracker::add_power(int64_t t, int32_t watts) {
+	roll(t);
+	integrated += held(t);
+	power = watts / 1000.0f;
+	power_t = t;
+	power_valid = true;
+}
+
+float
+Tracker::predict(int64_t t) const {
+	if (!power_valid || slot_of(t) != current) {
+		return NAN;
+	}
+	auto end = (current + 1) * SLOT;
+	auto total = consumed(t) + power * (end - t) / MS_PER_HOUR;
+	return static_cast<float>(total * MS_PER_HOUR / SLOT);
+}
+
+}  // namespace demand
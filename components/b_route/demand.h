@@ -0,0 +1,47 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+namespace demand {
+
+// Demand (average power) of the 30 minute slots of the meter, tracked incrementally.
+// Energy consumed in the slot is integrated from momentary power (sample and hold) and kept
+// within the range allowed by the integral energy counter, which truncates to its resolution;
+// the rest of the slot is extrapolated with the last power. O(1) state and work per sample.
+class Tracker {
+ public:
+	static constexpr int64_t SLOT = 1'800'000;
+
+	// integral energy (kWh) read at meter time t (ms), `resolution` kWh per count
+	void add_energy(int64_t t, double kwh, double resolution);
+	// momentary power (W) read at meter time t (ms)
+	void add_power(int64_t t, int32_t watts);
+	// predicted demand (kW) of the slot at meter time t, NAN without a power reading
+	float predict(int64_t t) const;
+	// demand (kW) of the previous slot, NAN if not tracked through it
+	float last_demand() const { return last; }
+	// index of the current slot
+	int64_t slot() const { return current; }
+
+ private:
+	int64_t current = -1;
+	// slot relative energy (kWh) up to anchor_t, the slot start or the last counter read
+	double consumed_at_anchor = 0;
+	int64_t anchor_t = 0;
+	// power integrated from anchor_t up to power_t
+	double integrated = 0;
+	// counter value at the slot start
+	double base = 0;
+	bool base_valid = false;
+	float power = 0;  // kW
+	int64_t power_t = 0;
+	bool power_valid = false;
+	float last = NAN;
+
+	void roll(int64_t t);
+	// energy (kWh) since the last power reading, held at that power
+	double held(int64_t t) const;
+	double consumed(int64_t t) const { return consumed_at_anchor + integrated + held(t); }
+};
+
+}  // namespace demand
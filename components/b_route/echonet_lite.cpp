@@ -3,18 +3,27 @@
 
 bool
 echonet_lite::Codec::decode_packet(const std::byte* data, size_t data_len, Packet& out) {
-	constexpr const size_t p_min = 12;
-	static_assert(offsetof(Packet, properties) == p_min);
-	if (data_len < 12) {
+	return decode_header(data, data_len, out) && decode_properties(data, data_len, out);
+}
+
+bool
+echonet_lite::Codec::decode_header(const std::byte* data, size_t data_len, Packet& out) {
+	static_assert(offsetof(Packet, properties) == HEADER_SIZE);
+	if (data_len < HEADER_SIZE) {
 		return false;
 	}
-	std::copy(data, data + p_min, reinterpret_cast<std::byte*>(&out));
+	std::copy(data, data + HEADER_SIZE, reinterpret_cast<std::byte*>(&out));
 	if (out.ehd1 != EHD1 || out.ehd2 != EHD2_Format1) {
 		// currently EHD2_Format2 is not supported
 		return false;
 	}
 	out.tid = (std::to_integer<uint8_t>(data[2]) << 8) + std::to_integer<uint8_t>(data[3]);
-	for (int pos = p_min, n = 0; n < out.opc; n++) {
+	return out.opc <= MAX_PROPERTIES;
+}
+
+bool
+echonet_lite::Codec::decode_properties(const std::byte* data, size_t data_len, Packet& out) {
+	for (size_t pos = HEADER_SIZE, n = 0; n < out.opc; n++) {
 		if (data_len < pos + 2) {
 			return false;
 		}
@@ -29,3 +38,54 @@ echonet_lite::Codec::decode_packet(const std::byte* data, size_t data_len, Packe
 	}
 	return true;
 }
+
+bool
+echonet_lite::Codec::find_instance(const std::byte* data, size_t data_len, uint8_t x1, uint8_t x2, EOJ& out) {
+	if (data_len < 1) {
+		return false;
+	}
+	size_t n = std::to_integer<uint8_t>(data[0]);
+	for (size_t i = 0, pos = 1; i < n && pos + 3 <= data_len; i++, pos += 3) {
+		if (std::to_integer<uint8_t>(data[pos]) == x1 && std::to_integer<uint8_t>(data[pos + 1]) == x2) {
+			out = {x1, x2, std::to_integer<uint8_t>(data[pos + 2])};
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+echonet_lite::Codec::decode_property_map(const std::byte* data, size_t data_len, PropertyMap& out) {
+	out = {};
+	if (data_len < 1) {
+		return false;
+	}
+	auto n = std::to_integer<uint8_t>(data[0]);
+	if (n < 16) {
+		if (data_len != 1u + n) {
+			return false;
+		}
+		for (size_t i = 1; i <= n; i++) {
+			out.set(std::to_integer<uint8_t>(data[i]));
+		}
+		return true;
+	}
+	if (data_len != 1 + sizeof(out.bits)) {
+		return false;
+	}
+	for (size_t i = 0; i < sizeof(out.bits); i++) {
+		out.bits[i] = std::to_integer<uint8_t>(data[1 + i]);
+	}
+	return true;
+}
+
+uint8_t
+echonet_lite::PropertyMap::count() const {
+	uint8_t n = 0;
+	for (auto b : bits) {
+		for (; b; b &= b - 1) {
+			n++;
+		}
+	}
+	return n;
+}
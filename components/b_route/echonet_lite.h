@@ -2,10 +2,11 @@
 #include <array>
 #include <cstddef>
 #include <cstdint>
+#include <iterator>
 
 namespace echonet_lite {
 
-constexpr int MAX_PROPERTIES = 3;
+constexpr int MAX_PROPERTIES = 8;
 static constexpr uint8_t EHD1 = 0x10;
 constexpr uint16_t UDP_PORT = 3610;
 
@@ -45,6 +46,20 @@ struct __attribute__((__packed__)) IntegralPowerWithDateTime {
 	uint32_t value;
 };
 
+// Property map (0x9D/0x9E/0x9F) as a bitmap, in the on-wire layout of the bitmap format:
+// byte = lower nibble of the EPC, bit = upper nibble - 8
+struct PropertyMap {
+	uint8_t bits[16];
+
+	bool has(uint8_t epc) const { return epc >= 0x80 && (bits[epc & 0x0F] & (1 << ((epc >> 4) - 8))); }
+	void set(uint8_t epc) {
+		if (epc >= 0x80) {
+			bits[epc & 0x0F] |= 1 << ((epc >> 4) - 8);
+		}
+	}
+	uint8_t count() const;
+};
+
 enum class ESV : uint8_t {
 	Get_SNA = 0x52,
 	Get = 0x62,
@@ -53,9 +68,6 @@ enum class ESV : uint8_t {
 };
 
 class Codec {
- private:
-	static constexpr uint16_t TID = 0;
-
  public:
 	static void write_eoj(const EOJ& eoj, std::byte*& dest, size_t max_size, size_t& written) {
 		if (max_size >= written + 3) {
@@ -65,13 +77,33 @@ class Codec {
 		}
 		written += 3;
 	}
+	static constexpr size_t HEADER_SIZE = 12;
 	static bool decode_packet(const std::byte* data, size_t data_len, Packet& out);
+	// EHD, TID, SEOJ, DEOJ, ESV and OPC from the first HEADER_SIZE bytes
+	static bool decode_header(const std::byte* data, size_t data_len, Packet& out);
+	// properties following the header, data includes the header
+	static bool decode_properties(const std::byte* data, size_t data_len, Packet& out);
+	// list format when less than 16 properties, bitmap format otherwise
+	static bool decode_property_map(const std::byte* data, size_t data_len, PropertyMap& out);
+	// first instance of class group x1, class x2 in an instance list (0xD5/0xD6)
+	static bool find_instance(const std::byte* data, size_t data_len, uint8_t x1, uint8_t x2, EOJ& out);
 
 	template <typename PropertyCodes, size_t N>
 	static size_t encode_property_get(std::array<std::byte, N>& out,
+	                                  uint16_t tid,
 	                                  const EOJ& seoj,
 	                                  const EOJ& deoj,
 	                                  const PropertyCodes& property_codes) {
+		return encode_property_get(out, tid, seoj, deoj, std::begin(property_codes), std::end(property_codes));
+	}
+
+	template <typename Iter, size_t N>
+	static size_t encode_property_get(std::array<std::byte, N>& out,
+	                                  uint16_t tid,
+	                                  const EOJ& seoj,
+	                                  const EOJ& deoj,
+	                                  Iter codes_begin,
+	                                  Iter codes_end) {
 		size_t written = 0;
 		std::byte* dest = std::begin(out);
 		if (N >= 2) {
@@ -81,8 +113,8 @@ class Codec {
 		written += 2;
 		// TID
 		if (N >= written + 2) {
-			*dest++ = std::byte{TID >> 8};
-			*dest++ = std::byte{TID & 0xff};
+			*dest++ = static_cast<std::byte>(tid >> 8);
+			*dest++ = static_cast<std::byte>(tid & 0xff);
 		}
 		written += 2;
 		// SEOJ, DEOJ
@@ -96,7 +128,8 @@ class Codec {
 		int cnt = 0;
 		std::byte* opc_p = dest++;
 		written += 1;
-		for (uint8_t prop : property_codes) {
+		for (auto it = codes_begin; it != codes_end; ++it) {
+			uint8_t prop = *it;
 			cnt++;
 			if (N >= written + 2) {
 				*dest++ = std::byte{prop};
@@ -119,8 +152,18 @@ class Codec {
 	}
 };
 
+namespace props::node_profile {
+
+constexpr uint8_t INSTANCE_LIST_NOTIFICATION = 0xD5;
+constexpr uint8_t SELF_NODE_INSTANCE_LIST = 0xD6;
+
+}  // namespace props::node_profile
+
 namespace props::lowv_smart_meter {
 
+constexpr uint8_t CURRENT_TIME = 0x97;
+constexpr uint8_t GET_PROPERTY_MAP = 0x9F;
+constexpr uint8_t CURRENT_DATE = 0x98;
 constexpr uint8_t ENERGY_COEFF = 0xD3;
 constexpr uint8_t ENERGY_UNIT = 0xE1;
 constexpr uint8_t INTEGRAL_ENERGY_FWD = 0xE0;
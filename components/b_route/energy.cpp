@@ -0,0 +1,52 @@
+#include "energy.h"
+
+namespace energy {
+
+namespace {
+
+// exact in double up to 10^22
+constexpr double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14};
+
+}  // namespace
+
+void
+Scale::set_coefficient(uint32_t c) {
+	coefficient = c ? c : 1;
+	coefficient_set = true;
+	normalize();
+}
+
+bool
+Scale::set_unit(uint8_t code) {
+	if (code <= 0x04) {
+		unit_exp = -code;
+	} else if (code >= 0x0A && code <= 0x0D) {
+		unit_exp = code - 0x09;
+	} else {
+		return false;
+	}
+	unit_set = true;
+	normalize();
+	return true;
+}
+
+void
+Scale::normalize() {
+	mult = coefficient;
+	exp = unit_exp;
+	while (mult % 10 == 0) {
+		mult /= 10;
+		exp++;
+	}
+}
+
+double
+Scale::kwh(uint32_t counter) const {
+	// counter * multiplier < 2^53 (8 digit counter, 6 digit coefficient), exact as double;
+	// a single correctly rounded operation by an exact power of ten keeps the order of readings
+	auto v = static_cast<double>(scaled(counter));
+	auto e = exp < 0 ? -exp : exp;
+	return exp < 0 ? v / POW10[e] : v * POW10[e];
+}
+
+}  // namespace energy
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+
+namespace energy {
+
+// Integral energy scaling: kWh = counter * coefficient (0xD3) * unit (0xE1).
+// Kept as an integer multiplier and a decimal exponent so that a reading is
+// rounded only once, when converted to float for publishing; the result is
+// monotonic in the counter.
+class Scale {
+ public:
+	void set_coefficient(uint32_t c);
+	// 0xE1 code, false if unknown
+	bool set_unit(uint8_t code);
+	bool has_coefficient() const { return coefficient_set; }
+	bool ready() const { return coefficient_set && unit_set; }
+	uint32_t multiplier() const { return mult; }
+	int8_t exponent() const { return exp; }
+	// decimals needed to show one count
+	int8_t decimals() const { return exp < 0 ? -exp : 0; }
+	// integer value of the reading in units of 10^exponent kWh
+	uint64_t scaled(uint32_t counter) const { return static_cast<uint64_t>(counter) * mult; }
+	float to_kwh(uint32_t counter) const { return static_cast<float>(kwh(counter)); }
+	double kwh(uint32_t counter) const;
+
+ private:
+	uint32_t coefficient = 1;
+	int8_t unit_exp = 0;
+	bool coefficient_set = false;
+	bool unit_set = false;
+	// coefficient with trailing zeros moved into the exponent
+	uint32_t mult = 1;
+	int8_t exp = 0;
+
+	void normalize();
+};
+
+}  // namespace energy
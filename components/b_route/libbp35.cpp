@@ -1,6 +1,8 @@
 #include "libbp35.h"
 #include <esphome/core/hal.h>
+#include <algorithm>
 #include "bp35cmd.h"
+#include "profile.h"
 
 using namespace libbp35::cmd;
 namespace libbp35 {
@@ -56,6 +58,10 @@ event_str(event_t ev) {
 			return "ok";
 		case event_t::pandesc:
 			return "pandesc";
+		case event_t::info:
+			return "info";
+		case event_t::sreg:
+			return "sreg";
 		case event_t::rxudp:
 			return "rxudp";
 		case event_t::ver:
@@ -67,33 +73,46 @@ event_str(event_t ev) {
 }
 
 bool
-BP35::read_line(std::string& line, uint32_t timeout) {
-	auto start = esphome::millis();
-	bool read1 = false;
-	while (esphome::millis() - start < timeout) {
-		int c = stream.read();
-		if (c == '\n')
+BP35::read_line(std::string_view& line) {
+	B_ROUTE_PROBE(read_line);
+	if (line_complete) {
+		// the previous line has been consumed
+		line_len = 0;
+		line_complete = false;
+	}
+	for (int c; (c = stream.read()) >= 0;) {
+		uart_stats.bytes++;
+		if (c == '\n') {
 			continue;
-		if (c < 0) {
-			if (!read1) {
-				return false;
+		}
+		if (c != '\r') {
+			if (line_len == 0) {
+				line_started = esphome::micros();
+			}
+			if (line_len < MAX_LINE) {
+				line_buf[line_len++] = static_cast<char>(c);
+			} else {
+				line_overflow = true;
 			}
-			esphome::delay(1);
 			continue;
 		}
-		read1 = true;
-		while (c >= 0 && c != '\r') {
-			if (c != '\n') {
-				line += static_cast<char>(c);
-			}
-			c = stream.read();
+		if (line_overflow) {
+			uart_stats.overflows++;
+			line_overflow = false;
+			line_len = 0;
+			continue;
 		}
-		if (c == '\r') {
-			if (line.size() == 0) {
-				return false;
-			}
-			return true;
+		if (line_len == 0) {
+			continue;
 		}
+		auto latency = esphome::micros() - line_started;
+		uart_stats.lines++;
+		uart_stats.latency_total += latency;
+		uart_stats.latency_max = std::max(uart_stats.latency_max, latency);
+		line_buf[line_len] = '\0';
+		line_complete = true;
+		line = {line_buf.data(), line_len};
+		return true;
 	}
 	return false;
 }
@@ -117,9 +136,25 @@ BP35::parse_rxudp(std::string_view remain, rxudp_t& out) {
 	if (!arg::get_mac(pos, end, out.sender_lla) || !arg::skip_sep(pos, end)) {
 		return false;
 	}
+	// some firmware inserts RSSI before and SIDE after the SECURED field
+	auto field_len = [&pos, &end] { return std::distance(pos, std::find(pos, end, ' ')); };
+	out.has_rssi = field_len() == 2;
+	if (out.has_rssi) {
+		uint8_t rssi;
+		if (!arg::get_num8(pos, end, rssi) || !arg::skip_sep(pos, end)) {
+			return false;
+		}
+		out.rssi = static_cast<int8_t>(rssi);
+	}
 	if (!arg::get_flag(pos, end, out.secured) || !arg::skip_sep(pos, end)) {
 		return false;
 	}
+	if (out.has_rssi && field_len() == 1) {
+		uint8_t side;
+		if (!arg::get_mode(pos, end, side) || !arg::skip_sep(pos, end)) {
+			return false;
+		}
+	}
 	if (!arg::get_num16(pos, end, out.data_len) || !arg::skip_sep(pos, end)) {
 		return false;
 	}
@@ -128,55 +163,117 @@ BP35::parse_rxudp(std::string_view remain, rxudp_t& out) {
 	return true;
 }
 
+bool
+BP35::parse_rxudp_lport(std::string_view remain, uint16_t& lport) {
+	// <SENDER(39)> <DEST(39)> <RPORT(4)> <LPORT(4)>
+	constexpr size_t LPORT_POS = 39 + 1 + 39 + 1 + 4 + 1;
+	if (remain.size() < LPORT_POS + 4) {
+		return false;
+	}
+	auto pos = remain.data() + LPORT_POS;
+	return arg::get_num16(pos, pos + 4, lport);
+}
+
+bool
+BP35::parse_pandesc_line(std::string_view line, pandesc_t& out) {
+	// descriptor lines are indented, "  Key:Value"
+	auto pos = line.find_first_not_of(' ');
+	if (pos == 0 || pos == line.npos) {
+		return false;
+	}
+	line.remove_prefix(pos);
+	auto sep = line.find(':');
+	if (sep == line.npos) {
+		return false;
+	}
+	auto key = line.substr(0, sep);
+	auto value = line.substr(sep + 1);
+	auto cur = std::cbegin(value);
+	auto end = std::cend(value);
+	if (key == "Addr") {
+		if (!arg::get_mac(cur, end, out.addr)) {
+			return false;
+		}
+		out.fields |= pandesc_t::HAS_ADDR;
+	} else if (key == "Pan ID") {
+		if (!arg::get_num16(cur, end, out.panid)) {
+			return false;
+		}
+		out.fields |= pandesc_t::HAS_PANID;
+	} else if (key == "Channel") {
+		if (!arg::get_num8(cur, end, out.channel)) {
+			return false;
+		}
+		out.fields |= pandesc_t::HAS_CHANNEL;
+	} else if (key == "LQI") {
+		if (!arg::get_num8(cur, end, out.lqi)) {
+			return false;
+		}
+		out.fields |= pandesc_t::HAS_LQI;
+	} else {
+		return false;
+	}
+	return true;
+}
+
 event_t
-BP35::get_event(uint32_t timeout, event_params_t& params) {
+BP35::get_event(event_params_t& params) {
 	params.clear();
-	std::string line;
-	for (auto remain = timeout; remain > 0;) {
-		line.clear();
-		auto started = esphome::millis();
-		if (!read_line(line, remain)) {
+	std::string_view line;
+	do {
+		if (!read_line(line)) {
 			return event_t::none;
 		}
-		if (line.rfind("SK", 0) == 0) {
-			auto elapsed = esphome::millis() - started;
-			if (remain > elapsed) {
-				remain -= elapsed;
-			} else {
-				return event_t::none;
-			}
-			continue;
-		}
-		break;
-	}
-	params.line = std::move(line);
+		// skip echo back of commands
+	} while (line.rfind("SK", 0) == 0);
+	B_ROUTE_PROBE(match);
+	params.line = line;
 	if (params.line == "OK") {
 		return event_t::ok;
 	}
 	if (params.line.rfind("OK ", 0) == 0) {
-		params.remain = std::string_view{params.line}.substr(3);
+		params.remain = params.line.substr(3);
 		return event_t::ok;
 	}
 	if (params.line.rfind("EVER ", 0) == 0) {
-		params.remain = std::string_view{params.line}.substr(5);
+		params.remain = params.line.substr(5);
 		return event_t::ver;
 	}
 	if (params.line.rfind("EVENT ", 0) == 0) {
-		params.remain = std::string_view{params.line}.substr(6);
+		params.remain = params.line.substr(6);
 		auto beg = std::cbegin(params.remain);
 		if (!arg::get_num8(beg, std::cend(params.remain), params.event.num)) {
 			params.event.num = 0;
 		}
+		// EVENT <NUM> <SENDER> [<SIDE>] [<PARAM>], PARAM is the last field if present
+		auto fields = params.remain.substr(std::distance(std::cbegin(params.remain), beg));
+		auto last = fields.rfind(' ');
+		if (last != fields.npos && last > 0 && fields.length() - last == 3) {
+			auto pbeg = std::cbegin(fields) + last + 1;
+			uint8_t param;
+			if (fields.find(' ') != last && arg::get_num8(pbeg, std::cend(fields), param)) {
+				params.event.has_param = true;
+				params.event.param = param;
+			}
+		}
 		return event_t::event;
 	}
 	if (params.line.rfind("ERXUDP ", 0) == 0) {
-		params.remain = std::string_view{params.line}.substr(7);
+		params.remain = params.line.substr(7);
 		return event_t::rxudp;
 	}
-	if (params.line.rfind("EPANDESC ", 0) == 0) {
-		params.remain = std::string_view{params.line}.substr(9);
+	if (params.line.rfind("EINFO ", 0) == 0) {
+		params.remain = params.line.substr(6);
+		return event_t::info;
+	}
+	if (params.line == "EPANDESC" || params.line.rfind("EPANDESC ", 0) == 0) {
+		params.remain = params.line.substr(8);
 		return event_t::pandesc;
 	}
+	if (params.line.rfind("ESREG ", 0) == 0) {
+		params.remain = params.line.substr(6);
+		return event_t::sreg;
+	}
 	return event_t::unknown;
 }
 
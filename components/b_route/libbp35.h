@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include <string>
 #include <string_view>
 
@@ -10,6 +11,8 @@ enum class event_t {
 	ver,
 	rxudp,
 	pandesc,
+	info,
+	sreg,
 	event,
 	ok,
 	unknown,
@@ -19,17 +22,21 @@ extern const char* event_str(event_t ev);
 extern const char* event_num_str(uint8_t num);
 
 struct event_params_t {
-	std::string line;
+	std::string_view line;  // valid until the next get_event()
 	std::string_view remain;
 	union {
 		struct {
 			uint8_t num;
+			bool has_param;
+			uint8_t param;  // e.g. EVENT 21 result, 0: success, 1: failure, 2: neighbor solicitation
 		} event;
 	};
 	void clear() {
-		line.clear();
+		line = {};
 		remain = {};
 		event.num = 0;
+		event.has_param = false;
+		event.param = 0;
 	}
 };
 
@@ -39,17 +46,45 @@ struct rxudp_t {
 	uint16_t rport;
 	uint16_t lport;
 	uint8_t sender_lla[8];
+	bool has_rssi;  // only reported by some firmware (e.g. BP35C0)
+	int8_t rssi;
 	bool secured;
 	uint16_t data_len;
 	std::string::size_type data_pos;
 };
 
+struct pandesc_t {
+	static constexpr uint8_t HAS_ADDR = 0x01;
+	static constexpr uint8_t HAS_PANID = 0x02;
+	static constexpr uint8_t HAS_CHANNEL = 0x04;
+	static constexpr uint8_t HAS_LQI = 0x08;
+
+	uint8_t addr[8];
+	uint16_t panid;
+	uint8_t channel;
+	uint8_t lqi;
+	uint8_t fields;
+
+	bool complete() const {
+		constexpr uint8_t required = HAS_ADDR | HAS_PANID | HAS_CHANNEL;
+		return (fields & required) == required;
+	}
+};
+
+struct uart_stats_t {
+	uint32_t bytes;
+	uint32_t lines;
+	uint32_t overflows;      // lines longer than the line buffer, dropped
+	uint32_t latency_total;  // us from the first byte to the end of line
+	uint32_t latency_max;
+};
+
 class SerialIO {
  public:
 	virtual size_t write(const char* str) = 0;
 	virtual size_t write(char) = 0;
 	virtual size_t write(const char* str, size_t len) = 0;
-	virtual int read();
+	virtual int read() = 0;
 };
 
 class BP35 {
@@ -80,13 +115,30 @@ class BP35 {
 		stream.write(' ');
 		stream.write(reinterpret_cast<const char*>(data), data_len);
 	}
-	bool read_line(std::string& line, uint32_t timeout);
-	event_t get_event(uint32_t timeout, event_params_t& params);
+	// reads what is available without waiting, true once a complete line is in `line`
+	bool read_line(std::string_view& line);
+	event_t get_event(event_params_t& params);
+	// part of a line has been received
+	bool line_pending() const { return line_len > 0 && !line_complete; }
+	const uart_stats_t& stats() const { return uart_stats; }
+	void reset_stats() { uart_stats = {}; }
 
 	static bool parse_rxudp(std::string_view remains, rxudp_t& out);
+	// LPORT only, at its fixed position after the two addresses and RPORT
+	static bool parse_rxudp_lport(std::string_view remains, uint16_t& lport);
+	static bool parse_pandesc_line(std::string_view line, pandesc_t& out);
+
+	// ERXUDP of a full 1232 byte UDP payload does not fit, meter frames are much smaller
+	static constexpr size_t MAX_LINE = 1024;
 
  private:
 	SerialIO& stream;
+	std::array<char, MAX_LINE + 1> line_buf{};
+	size_t line_len = 0;
+	bool line_complete = false;
+	bool line_overflow = false;
+	uint32_t line_started = 0;
+	uart_stats_t uart_stats{};
 };
 
 }  // namespace libbp35
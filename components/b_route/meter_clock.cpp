@@ -0,0 +1,125 @@
+#include "meter_clock.h"
+#include <algorithm>
+
+namespace meter_clock {
+
+namespace {
+
+constexpr int64_t MS_PER_DAY = 86'400'000;
+
+// days since 1970-01-01 of a proleptic Gregorian date (H. Hinnant's days_from_civil)
+int64_t
+days_from_civil(int64_t y, unsigned m, unsigned d) {
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	unsigned yoe = static_cast<unsigned>(y - era * 400);
+	unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+}  // namespace
+
+int64_t
+to_epoch_ms(const datetime_t& dt) {
+	return days_from_civil(dt.year, dt.mon, dt.day) * MS_PER_DAY +
+	       ((dt.hour * 60 + dt.min) * 60 + dt.sec) * static_cast<int64_t>(1000);
+}
+
+datetime_t
+from_epoch_ms(int64_t ms) {
+	int64_t days = ms / MS_PER_DAY;
+	int64_t rem = ms % MS_PER_DAY;
+	if (rem < 0) {
+		rem += MS_PER_DAY;
+		days--;
+	}
+	// civil_from_days
+	days += 719468;
+	int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned doe = static_cast<unsigned>(days - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	unsigned d = doy - (153 * mp + 2) / 5 + 1;
+	unsigned m = mp < 10 ? mp + 3 : mp - 9;
+	datetime_t dt;
+	dt.year = static_cast<uint16_t>(yoe + era * 400 + (m <= 2));
+	dt.mon = m;
+	dt.day = d;
+	auto sec = static_cast<uint32_t>(rem / 1000);
+	dt.hour = sec / 3600;
+	dt.min = sec / 60 % 60;
+	dt.sec = sec % 60;
+	return dt;
+}
+
+bool
+Clock::sync(uint32_t sent, uint32_t received, int64_t meter, uint32_t resolution) {
+	// at `received` the meter shows at least `meter`, and at most the resolution plus the round trip later
+	int64_t obs_lo = meter;
+	int64_t obs_hi = meter + resolution + (received - sent);
+	bool consistent = true;
+	if (synced) {
+		uint32_t elapsed = received - anchor;
+		auto slack = static_cast<int64_t>(elapsed * DRIFT_SLACK);
+		int64_t pred_lo = project(lo, elapsed) - slack;
+		int64_t pred_hi = project(hi, elapsed) + slack;
+		if (obs_lo <= pred_hi && pred_lo <= obs_hi) {
+			lo = std::max(obs_lo, pred_lo);
+			hi = std::min(obs_hi, pred_hi);
+			anchor = received;
+			update_drift();
+			return true;
+		}
+		// the meter clock was set, start over
+		consistent = false;
+	}
+	lo = obs_lo;
+	hi = obs_hi;
+	anchor = received;
+	drift = 0;
+	synced = true;
+	set_reference();
+	return consistent;
+}
+
+void
+Clock::set_reference() {
+	ref_local = anchor;
+	ref_meter = lo + (hi - lo) / 2;
+	ref_uncertainty = uncertainty();
+}
+
+void
+Clock::update_drift() {
+	uint32_t span = anchor - ref_local;
+	if (span < DRIFT_MIN_SPAN) {
+		// early readings are coarse, keep the most precise one as the reference
+		if (uncertainty() * 2 < ref_uncertainty) {
+			set_reference();
+		}
+		return;
+	}
+	// only trust the estimate if both ends are precise enough for the span, otherwise let the span grow
+	if (static_cast<float>(uncertainty() + ref_uncertainty) / span > DRIFT_PRECISION) {
+		return;
+	}
+	int64_t mid = lo + (hi - lo) / 2;
+	float measured = static_cast<float>(mid - ref_meter - span) / span;
+	drift = std::clamp(measured, -MAX_DRIFT, MAX_DRIFT);
+	set_reference();
+}
+
+int64_t
+Clock::now(uint32_t local) const {
+	return project(lo + (hi - lo) / 2, local - anchor);
+}
+
+uint32_t
+Clock::until_boundary(uint32_t local, uint32_t period, uint32_t delay) const {
+	auto rem = static_cast<uint32_t>(now(local) % period);
+	return rem < delay ? delay - rem : period - rem + delay;
+}
+
+}  // namespace meter_clock
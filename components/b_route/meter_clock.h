@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+
+namespace meter_clock {
+
+// Meter local time (the meter has no notion of timezone).
+struct datetime_t {
+	uint16_t year;
+	uint8_t mon;
+	uint8_t day;
+	uint8_t hour;
+	uint8_t min;
+	uint8_t sec;
+};
+
+// ms since 1970-01-01 00:00 of the same (local) clock
+int64_t to_epoch_ms(const datetime_t& dt);
+datetime_t from_epoch_ms(int64_t ms);
+
+// Tracks the meter clock against the local monotonic clock (millis()).
+// Each reading bounds the meter time, the intersection of the bounds carried forward
+// with a drift allowance narrows it below the resolution of a single reading.
+// The drift is estimated from readings several hours apart.
+class Clock {
+ public:
+	// `meter` was read between local times `sent` and `received` and is truncated to `resolution` ms.
+	// Returns false when the reading contradicts the previous ones and the clock was re-anchored.
+	bool sync(uint32_t sent, uint32_t received, int64_t meter, uint32_t resolution);
+	void reset() { synced = false; }
+	bool valid() const { return synced; }
+	// best estimate of the meter time at local time `local`
+	int64_t now(uint32_t local) const;
+	// local ms until `delay` after the next multiple of `period` on the meter clock
+	uint32_t until_boundary(uint32_t local, uint32_t period, uint32_t delay) const;
+	uint32_t uncertainty() const { return static_cast<uint32_t>(hi - lo); }
+	float drift_ppm() const { return drift * 1e6f; }
+
+ private:
+	static constexpr float MAX_DRIFT = 500e-6f;
+	// allowance for the error of the drift estimate when carrying bounds forward
+	static constexpr float DRIFT_SLACK = 100e-6f;
+	static constexpr float DRIFT_PRECISION = 20e-6f;
+	static constexpr uint32_t DRIFT_MIN_SPAN = 6 * 3'600'000;
+
+	bool synced = false;
+	uint32_t anchor = 0;  // local time of the last reading
+	int64_t lo = 0;       // bounds of the meter time at anchor
+	int64_t hi = 0;
+	float drift = 0;  // meter rate error relative to the local clock
+	// reference point for the drift estimation
+	uint32_t ref_local = 0;
+	int64_t ref_meter = 0;
+	uint32_t ref_uncertainty = 0;
+
+	int64_t project(int64_t t, uint32_t elapsed) const { return t + elapsed + static_cast<int64_t>(elapsed * drift); }
+	void set_reference();
+	void update_drift();
+};
+
+}  // namespace meter_clock
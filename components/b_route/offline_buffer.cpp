@@ -0,0 +1,108 @@
+#include "offline_buffer.h"
+#include <new>
+
+namespace offline {
+
+namespace {
+
+size_t
+put_varint(uint8_t* out, uint32_t v) {
+	size_t n = 0;
+	while (v >= 0x80) {
+		out[n++] = static_cast<uint8_t>(v | 0x80);
+		v >>= 7;
+	}
+	out[n++] = static_cast<uint8_t>(v);
+	return n;
+}
+
+uint32_t
+zigzag(int32_t v) {
+	return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+int32_t
+unzigzag(uint32_t v) {
+	return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+}  // namespace
+
+bool
+ReadingBuffer::init(size_t size) {
+	data.reset(new (std::nothrow) uint8_t[size]);
+	capacity = data ? size : 0;
+	head = used = count = 0;
+	return capacity > 0;
+}
+
+void
+ReadingBuffer::push(const reading_t& r) {
+	if (!enabled() || r.channel >= MAX_CHANNELS) {
+		return;
+	}
+	uint8_t rec[MAX_RECORD];
+	uint32_t dt = (r.time - newest.time) / 1000;
+	size_t len = put_varint(rec, r.channel);
+	len += put_varint(rec + len, dt);
+	len += put_varint(rec + len, zigzag(static_cast<int32_t>(r.value - newest.values[r.channel])));
+	while (capacity - used < len) {
+		reading_t discard;
+		if (!pop(discard)) {
+			return;
+		}
+		n_dropped++;
+	}
+	for (size_t i = 0, pos = (head + used) % capacity; i < len; i++, pos = (pos + 1) % capacity) {
+		data[pos] = rec[i];
+	}
+	used += len;
+	count++;
+	newest.time += dt * 1000;
+	newest.values[r.channel] = r.value;
+}
+
+bool
+ReadingBuffer::pop(reading_t& r) {
+	size_t len;
+	if (count == 0 || !decode(r, len)) {
+		return false;
+	}
+	head = (head + len) % capacity;
+	used -= len;
+	count--;
+	oldest.time = r.time;
+	oldest.values[r.channel] = r.value;
+	return true;
+}
+
+bool
+ReadingBuffer::decode(reading_t& r, size_t& len) {
+	uint32_t fields[3];
+	size_t pos = head;
+	len = 0;
+	for (auto& f : fields) {
+		f = 0;
+		for (int shift = 0;; shift += 7) {
+			if (len >= used || shift > 28) {
+				return false;
+			}
+			uint8_t b = data[pos];
+			pos = (pos + 1) % capacity;
+			len++;
+			f |= static_cast<uint32_t>(b & 0x7f) << shift;
+			if (!(b & 0x80)) {
+				break;
+			}
+		}
+	}
+	if (fields[0] >= MAX_CHANNELS) {
+		return false;
+	}
+	r.channel = fields[0];
+	r.time = oldest.time + fields[1] * 1000;
+	r.value = oldest.values[r.channel] + unzigzag(fields[2]);
+	return true;
+}
+
+}  // namespace offline
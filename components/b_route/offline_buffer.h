@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace offline {
+
+struct reading_t {
+	uint8_t channel;
+	uint32_t time;   // millis(), stored with 1s resolution
+	uint32_t value;  // raw integer reading
+};
+
+// Fixed-size byte ring of readings, oldest dropped first when full.
+// Each record is varint(channel), varint(seconds since previous record) and
+// zigzag varint(value - previous value of the channel), typically 3-5 bytes.
+class ReadingBuffer {
+ public:
+	static constexpr size_t MAX_CHANNELS = 18;
+
+	bool init(size_t size);
+	bool enabled() const { return capacity > 0; }
+	void push(const reading_t& r);
+	bool pop(reading_t& r);
+	bool empty() const { return count == 0; }
+	uint32_t size() const { return count; }
+	size_t bytes_used() const { return used; }
+	uint32_t dropped() const { return n_dropped; }
+
+ private:
+	static constexpr size_t MAX_RECORD = 11;
+
+	// state before the oldest record and after the newest one, records are deltas between them
+	struct cursor_t {
+		uint32_t time;
+		uint32_t values[MAX_CHANNELS];
+	};
+
+	std::unique_ptr<uint8_t[]> data;
+	size_t capacity = 0;
+	size_t head = 0;
+	size_t used = 0;
+	uint32_t count = 0;
+	uint32_t n_dropped = 0;
+	cursor_t oldest{};
+	cursor_t newest{};
+
+	bool decode(reading_t& r, size_t& len);
+};
+
+}  // namespace offline
@@ -0,0 +1,42 @@
+#include "profile.h"
+
+namespace profile {
+
+const char*
+stage_name(stage_t stage) {
+	switch (stage) {
+		case stage_t::loop:
+			return "loop";
+		case stage_t::read_line:
+			return "read_line";
+		case stage_t::match:
+			return "match";
+		case stage_t::parse_rxudp:
+			return "parse_rxudp";
+		case stage_t::hex2bin:
+			return "hex2bin";
+		case stage_t::decode:
+			return "decode";
+		case stage_t::handle_response:
+			return "handle_response";
+		default:
+			return "unknown";
+	}
+}
+
+#ifdef USE_B_ROUTE_PROFILE
+
+std::array<Histogram, static_cast<size_t>(stage_t::COUNT)> histograms{};
+
+uint32_t
+ticks_per_us() {
+#if defined(USE_ESP32) || defined(USE_ESP8266) || defined(USE_RP2040)
+	return esphome::arch_get_cpu_freq_hz() / 1'000'000;
+#else
+	return 1'000;
+#endif
+}
+
+#endif
+
+}  // namespace profile
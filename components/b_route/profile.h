@@ -0,0 +1,112 @@
+#pragma once
+#include <esphome/core/defines.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#ifdef USE_B_ROUTE_PROFILE
+#if defined(USE_ESP32) || defined(USE_ESP8266) || defined(USE_RP2040)
+#include <esphome/core/hal.h>
+#else
+#include <chrono>
+#endif
+#endif
+
+namespace profile {
+
+// kept in sync with stage_name()
+enum class stage_t : uint8_t {
+	loop,             // one BRoute::loop() call
+	read_line,        // one BP35::read_line() call, whether or not a line completes
+	match,            // prefix matching of a received line in BP35::get_event()
+	parse_rxudp,      // ERXUDP field parsing
+	hex2bin,          // ECHONET Lite payload hex decoding, header and body
+	decode,           // ECHONET Lite header and property decoding
+	handle_response,  // property response handling, sensors included
+	COUNT,
+};
+
+const char* stage_name(stage_t stage);
+
+// log2 histogram of durations in ticks: bucket i counts [2^(i+MIN_SHIFT), 2^(i+MIN_SHIFT+1)),
+// the first and the last bucket are open ended
+class Histogram {
+ public:
+	static constexpr size_t BUCKETS = 16;
+	static constexpr unsigned MIN_SHIFT = 6;
+
+	void add(uint32_t ticks) {
+		size_t i = 0;
+		if (ticks >> MIN_SHIFT) {
+			i = 31 - __builtin_clz(ticks) - MIN_SHIFT;
+			i = i < BUCKETS ? i : BUCKETS - 1;
+		}
+		buckets[i]++;
+		n++;
+		sum += ticks;
+		peak = ticks > peak ? ticks : peak;
+	}
+	uint32_t count() const { return n; }
+	uint64_t total() const { return sum; }
+	uint32_t max() const { return peak; }
+	uint32_t bucket(size_t i) const { return buckets[i]; }
+	void reset() { *this = {}; }
+
+ private:
+	std::array<uint32_t, BUCKETS> buckets{};
+	uint32_t n = 0;
+	uint64_t sum = 0;
+	uint32_t peak = 0;
+};
+
+#ifdef USE_B_ROUTE_PROFILE
+
+// CPU cycles on the targets, nanoseconds elsewhere; wraps, only differences are meaningful
+inline uint32_t
+ticks() {
+#if defined(USE_ESP32) || defined(USE_ESP8266) || defined(USE_RP2040)
+	return esphome::arch_get_cpu_cycle_count();
+#else
+	return static_cast<uint32_t>(
+	    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+uint32_t ticks_per_us();
+
+// shared by all instances, the probes sit in code that does not know its component
+extern std::array<Histogram, static_cast<size_t>(stage_t::COUNT)> histograms;
+
+// measures its own lifetime
+class Probe {
+ public:
+	explicit Probe(stage_t stage) : stage(stage), start(ticks()) {}
+	~Probe() { histograms[static_cast<size_t>(stage)].add(ticks() - start); }
+	Probe(const Probe&) = delete;
+	Probe& operator=(const Probe&) = delete;
+
+ private:
+	stage_t stage;
+	uint32_t start;
+};
+
+#define B_ROUTE_PROBE_NAME_(line) b_route_probe_##line
+#define B_ROUTE_PROBE_NAME(line) B_ROUTE_PROBE_NAME_(line)
+// times the rest of the enclosing scope as the given stage_t
+#define B_ROUTE_PROBE(stage) ::profile::Probe B_ROUTE_PROBE_NAME(__LINE__)(::profile::stage_t::stage)
+// times a single expression, for use inside conditions
+#define B_ROUTE_PROFILED(stage, expr) \
+	([&] { \
+		B_ROUTE_PROBE(stage); \
+		return (expr); \
+	}())
+
+#else
+
+#define B_ROUTE_PROBE(stage) \
+	do { \
+	} while (0)
+#define B_ROUTE_PROFILED(stage, expr) (expr)
+
+#endif
+
+}  // namespace profile
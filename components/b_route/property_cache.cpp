@@ -0,0 +1,97 @@
+#include "property_cache.h"
+#include <algorithm>
+
+namespace property_cache {
+
+uint32_t
+entry_t::as_unsigned() const {
+	uint32_t v = 0;
+	for (size_t i = 0; i < std::min<size_t>(pdc, 4); i++) {
+		v = (v << 8) | data[i];
+	}
+	return v;
+}
+
+int32_t
+entry_t::as_signed() const {
+	switch (pdc) {
+		case 1:
+			return static_cast<int8_t>(as_unsigned());
+		case 2:
+			return static_cast<int16_t>(as_unsigned());
+		default:
+			return static_cast<int32_t>(as_unsigned());
+	}
+}
+
+const entry_t*
+Cache::find(uint8_t epc) const {
+	auto end = entries.begin() + used;
+	auto it = std::find_if(entries.begin(), end, [epc](const entry_t& e) { return e.epc == epc; });
+	return it == end ? nullptr : &*it;
+}
+
+const entry_t*
+Cache::store(uint8_t epc, const uint8_t* data, uint8_t pdc, uint16_t tid, uint32_t now) {
+	if (pdc > entry_t::MAX_VALUE) {
+		return nullptr;
+	}
+	auto* e = const_cast<entry_t*>(find(epc));
+	if (e == nullptr) {
+		if (used < SIZE) {
+			e = &entries[used++];
+		} else {
+			e = &*std::max_element(entries.begin(), entries.end(),
+			                       [now](const entry_t& a, const entry_t& b) { return a.age(now) < b.age(now); });
+		}
+	}
+	e->epc = epc;
+	e->pdc = pdc;
+	e->tid = tid;
+	e->received = now;
+	std::copy(data, data + pdc, e->data.begin());
+	return e;
+}
+
+bool
+Cache::wait(uint8_t epc, uint32_t deadline, callback_t callback) {
+	for (auto& w : waiters) {
+		if (!w.callback) {
+			w = {epc, deadline, std::move(callback)};
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+Cache::resolve(uint8_t epc, const entry_t* entry) {
+	for (auto& w : waiters) {
+		if (w.callback && w.epc == epc) {
+			// the callback may wait again
+			auto callback = std::move(w.callback);
+			w.callback = nullptr;
+			callback(entry);
+		}
+	}
+}
+
+bool
+Cache::expire(uint32_t now) {
+	bool left = false;
+	for (auto& w : waiters) {
+		if (!w.callback) {
+			continue;
+		}
+		if (static_cast<int32_t>(now - w.deadline) >= 0) {
+			auto callback = std::move(w.callback);
+			w.callback = nullptr;
+			callback(nullptr);
+		} else {
+			left = true;
+		}
+	}
+	return left;
+}
+
+}  // namespace property_cache
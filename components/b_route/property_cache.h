@@ -0,0 +1,57 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace property_cache {
+
+// Latest value of one property (EPC) as received from the meter.
+struct entry_t {
+	static constexpr size_t MAX_VALUE = 16;
+
+	uint8_t epc;
+	uint8_t pdc;
+	uint16_t tid;
+	uint32_t received;  // millis()
+	std::array<uint8_t, MAX_VALUE> data;
+
+	uint32_t age(uint32_t now) const { return now - received; }
+	// big endian integer of 1, 2 or 4 bytes
+	uint32_t as_unsigned() const;
+	int32_t as_signed() const;
+};
+
+// nullptr when the meter did not provide the value
+using callback_t = std::function<void(const entry_t*)>;
+
+// Fixed set of cached properties, the least recently received replaced first,
+// and consumers waiting for a refresh of one of them.
+class Cache {
+ public:
+	static constexpr size_t SIZE = 16;
+	static constexpr size_t MAX_WAITERS = 8;
+
+	const entry_t* find(uint8_t epc) const;
+	// nullptr if the value does not fit
+	const entry_t* store(uint8_t epc, const uint8_t* data, uint8_t pdc, uint16_t tid, uint32_t now);
+	// false when all waiter slots are in use
+	bool wait(uint8_t epc, uint32_t deadline, callback_t callback);
+	// calls and removes the waiters of epc
+	void resolve(uint8_t epc, const entry_t* entry);
+	// fails the waiters past their deadline, true while any are left
+	bool expire(uint32_t now);
+
+ private:
+	struct waiter_t {
+		uint8_t epc;
+		uint32_t deadline;
+		callback_t callback;
+	};
+
+	std::array<entry_t, SIZE> entries{};
+	size_t used = 0;
+	std::array<waiter_t, MAX_WAITERS> waiters{};
+};
+
+}  // namespace property_cache
@@ -0,0 +1,73 @@
+#include "recovery.h"
+#include <algorithm>
+#include <iterator>
+
+namespace recovery {
+
+const char*
+action_str(action_t action) {
+	switch (action) {
+		case action_t::rejoin:
+			return "rejoin";
+		case action_t::rescan:
+			return "rescan";
+		case action_t::reset_module:
+			return "reset module";
+		case action_t::reboot:
+			return "reboot";
+		default:
+			return "unknown";
+	}
+}
+
+FixedPolicy::FixedPolicy(uint32_t rejoin, uint32_t rescan, uint32_t reset, uint32_t reboot) {
+	step_t abs[] = {{action_t::rejoin, rejoin},
+	                {action_t::rescan, rescan},
+	                {action_t::reset_module, reset},
+	                {action_t::reboot, reboot}};
+	std::stable_sort(std::begin(abs), std::end(abs), [](auto& a, auto& b) { return a.delay < b.delay; });
+	uint32_t prev = 0;
+	for (auto& s : abs) {
+		if (s.delay == 0) {
+			continue;
+		}
+		steps[count++] = {s.action, s.delay - prev};
+		prev = s.delay;
+	}
+}
+
+bool
+FixedPolicy::step(uint32_t n, step_t& out) {
+	if (count == 0) {
+		return false;
+	}
+	out = steps[n % count];
+	return true;
+}
+
+uint32_t
+BackoffPolicy::next_random() {
+	// xorshift32
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+bool
+BackoffPolicy::step(uint32_t n, step_t& out) {
+	static constexpr action_t LADDER[] = {action_t::rejoin, action_t::rejoin, action_t::rescan, action_t::rescan,
+	                                      action_t::reset_module};
+	constexpr uint32_t ladder_len = sizeof(LADDER) / sizeof(LADDER[0]);
+	if (base == 0) {
+		return false;
+	}
+	out.action = n < ladder_len ? LADDER[n] : ((n - ladder_len) % 2 == 0 ? action_t::rescan : action_t::reset_module);
+	uint64_t delay = static_cast<uint64_t>(base) << std::min<uint32_t>(n, 16);
+	delay = std::min<uint64_t>(delay, max);
+	delay = delay * (80 + next_random() % 41) / 100;
+	out.delay = static_cast<uint32_t>(std::max<uint64_t>(delay, 1));
+	return true;
+}
+
+}  // namespace recovery
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+namespace recovery {
+
+enum class action_t : uint8_t { rejoin, rescan, reset_module, reboot };
+
+struct step_t {
+	action_t action;
+	uint32_t delay;  // ms after data loss (first step) or after the previous step
+};
+
+class Policy {
+ public:
+	virtual ~Policy() = default;
+	virtual bool step(uint32_t n, step_t& out) = 0;
+	virtual const char* name() const = 0;
+};
+
+// Rejoin, rescan, module reset and reboot at fixed times after data loss, repeated while data stays lost.
+// A zero time leaves its step out, the reboot is off unless restart_timeout is set.
+class FixedPolicy : public Policy {
+ public:
+	FixedPolicy(uint32_t rejoin, uint32_t rescan, uint32_t reset, uint32_t reboot);
+	bool step(uint32_t n, step_t& out) override;
+	const char* name() const override { return "fixed"; }
+
+ private:
+	step_t steps[4]{};
+	uint8_t count = 0;
+};
+
+// Escalates rejoin, rejoin, rescan, rescan, module reset, then alternates rescan and module reset.
+// Delay doubles from `base` up to `max`, with +-20% jitter.
+class BackoffPolicy : public Policy {
+ public:
+	BackoffPolicy(uint32_t base, uint32_t max, uint32_t seed) : base(base), max(max), rng(seed ? seed : 1) {}
+	bool step(uint32_t n, step_t& out) override;
+	const char* name() const override { return "backoff"; }
+
+ private:
+	uint32_t base;
+	uint32_t max;
+	uint32_t rng;
+	uint32_t next_random();
+};
+
+const char* action_str(action_t action);
+
+}  // namespace recovery
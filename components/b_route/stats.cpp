@@ -0,0 +1,115 @@
+#include "stats.h"
+#include <algorithm>
+
+namespace stats {
+
+void
+P2Quantile::reset() {
+	n_samples = 0;
+	np[0] = 1;
+	np[1] = 1 + 2 * p;
+	np[2] = 1 + 4 * p;
+	np[3] = 3 + 2 * p;
+	np[4] = 5;
+	dn[0] = 0;
+	dn[1] = p / 2;
+	dn[2] = p;
+	dn[3] = (1 + p) / 2;
+	dn[4] = 1;
+	for (int i = 0; i < 5; i++) {
+		n[i] = i + 1;
+	}
+}
+
+float
+P2Quantile::parabolic(int i, int d) const {
+	return q[i] + static_cast<float>(d) / (n[i + 1] - n[i - 1]) *
+	                  ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+	                   (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+}
+
+float
+P2Quantile::linear(int i, int d) const {
+	return q[i] + d * (q[i + d] - q[i]) / (n[i + d] - n[i]);
+}
+
+void
+P2Quantile::add(float x) {
+	if (n_samples < 5) {
+		q[n_samples++] = x;
+		if (n_samples == 5) {
+			std::sort(q, q + 5);
+		}
+		return;
+	}
+	++n_samples;
+	int k;
+	if (x < q[0]) {
+		q[0] = x;
+		k = 0;
+	} else if (x >= q[4]) {
+		q[4] = x;
+		k = 3;
+	} else {
+		for (k = 0; k < 3 && x >= q[k + 1]; k++) {
+		}
+	}
+	for (int i = k + 1; i < 5; i++) {
+		n[i]++;
+	}
+	for (int i = 0; i < 5; i++) {
+		np[i] += dn[i];
+	}
+	for (int i = 1; i < 4; i++) {
+		float d = np[i] - n[i];
+		if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+			int ds = d > 0 ? 1 : -1;
+			float qp = parabolic(i, ds);
+			if (q[i - 1] < qp && qp < q[i + 1]) {
+				q[i] = qp;
+			} else {
+				q[i] = linear(i, ds);
+			}
+			n[i] += ds;
+		}
+	}
+}
+
+float
+P2Quantile::value() const {
+	if (n_samples == 0) {
+		return NAN;
+	}
+	if (n_samples >= 5) {
+		return q[2];
+	}
+	// too few samples for markers, pick from sorted copy
+	float s[5];
+	std::copy(q, q + n_samples, s);
+	std::sort(s, s + n_samples);
+	auto idx = std::min<uint32_t>(n_samples - 1, static_cast<uint32_t>(p * n_samples));
+	return s[idx];
+}
+
+void
+WindowAggregator::reset() {
+	n_samples = 0;
+	vmin = vmax = NAN;
+	sum = 0;
+	q95.reset();
+}
+
+void
+WindowAggregator::add(float x) {
+	if (n_samples == 0 || x < vmin) {
+		vmin = x;
+	}
+	if (n_samples == 0 || x > vmax) {
+		vmax = x;
+	}
+	sum += x;
+	++n_samples;
+	q95.add(x);
+}
+
+}  // namespace stats
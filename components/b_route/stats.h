@@ -0,0 +1,63 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace stats {
+
+// Streaming quantile estimator (P-square algorithm, Jain & Chlamtac 1985).
+// Keeps 5 markers regardless of the number of samples.
+class P2Quantile {
+ public:
+	explicit P2Quantile(float p) : p(p) { reset(); }
+	void reset();
+	void add(float x);
+	float value() const;
+	uint32_t count() const { return n_samples; }
+
+ private:
+	float p;
+	uint32_t n_samples = 0;
+	float q[5]{};
+	int32_t n[5]{};
+	float np[5]{};
+	float dn[5]{};
+
+	float parabolic(int i, int d) const;
+	float linear(int i, int d) const;
+};
+
+// Exponentially weighted moving average.
+class Ewma {
+ public:
+	explicit Ewma(float alpha) : alpha(alpha) {}
+	void add(float x) { v = std::isnan(v) ? x : v + alpha * (x - v); }
+	void reset(float x = NAN) { v = x; }
+	float value() const { return v; }
+	bool valid() const { return !std::isnan(v); }
+
+ private:
+	float alpha;
+	float v = NAN;
+};
+
+// Fixed-memory aggregator of min/max/mean/p95 for one publishing window.
+class WindowAggregator {
+ public:
+	void reset();
+	void add(float x);
+	uint32_t count() const { return n_samples; }
+	float min() const { return n_samples ? vmin : NAN; }
+	float max() const { return n_samples ? vmax : NAN; }
+	float mean() const { return n_samples ? static_cast<float>(sum / n_samples) : NAN; }
+	float p95() const { return n_samples ? q95.value() : NAN; }
+
+ private:
+	uint32_t n_samples = 0;
+	float vmin = NAN;
+	float vmax = NAN;
+	double sum = 0;
+	P2Quantile q95{0.95f};
+};
+
+}  // namespace stats
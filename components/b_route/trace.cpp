@@ -0,0 +1,22 @@
+#include "trace.h"
+#include <cstring>
+#include "util.h"
+
+namespace trace {
+
+size_t
+Buffer::hex(size_t i, size_t count, char* out) const {
+	size_t n = 0;
+	for (; n < count && i + n < size(); n++) {
+		uint8_t raw[sizeof(entry_t)];
+		std::memcpy(raw, &entries[(head - size() + i + n) % SIZE], sizeof(raw));
+		for (auto b : raw) {
+			*out++ = util::hexchar(b >> 4);
+			*out++ = util::hexchar(b & 0x0f);
+		}
+	}
+	*out = '\0';
+	return n;
+}
+
+}  // namespace trace
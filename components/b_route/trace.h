@@ -0,0 +1,58 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace trace {
+
+// kept in sync with tools/decode_trace.py
+enum class kind_t : uint8_t {
+	event = 1,    // code: libbp35::event_t, aux: EVENT number
+	tx = 2,       // code: first EPC, aux: number of EPCs, tid
+	rx = 3,       // code: first EPC, aux: ESV, tid, value: number of properties
+	rx_drop = 4,  // code: drop_t, value: LPORT when dropped by port
+	timeout = 5,  // code: first EPC, aux: attempts, tid
+	state = 6,    // code: new state
+};
+
+enum class drop_t : uint8_t {
+	malformed = 1,
+	port = 2,
+	header = 3,
+	seoj = 4,
+	esv = 5,
+	properties = 6,
+};
+
+struct entry_t {
+	uint32_t time;  // millis()
+	uint16_t tid;
+	uint16_t value;
+	uint8_t kind;
+	uint8_t state;  // state when recorded
+	uint8_t code;
+	uint8_t aux;
+};
+static_assert(sizeof(entry_t) == 12);
+
+// Fixed ring of binary entries, the oldest overwritten. Recording is a handful of stores;
+// entries are dumped as hex on demand and decoded on the host.
+class Buffer {
+ public:
+	static constexpr size_t SIZE = 128;
+
+	void add(uint32_t time, kind_t kind, uint8_t state, uint8_t code, uint8_t aux, uint16_t tid, uint16_t value) {
+		entries[head++ % SIZE] = {time, tid, value, static_cast<uint8_t>(kind), state, code, aux};
+	}
+	size_t size() const { return head < SIZE ? head : SIZE; }
+	// entries recorded since boot, including overwritten ones
+	uint32_t total() const { return head; }
+	// hex of `count` entries starting at the i-th oldest, in memory byte order; returns entries written
+	size_t hex(size_t i, size_t count, char* out) const;
+
+ private:
+	std::array<entry_t, SIZE> entries{};
+	uint32_t head = 0;
+};
+
+}  // namespace trace
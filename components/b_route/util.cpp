@@ -18,6 +18,24 @@ nibble(char c) {
 	return -1;
 }
 
+bool
+hex2bin(std::string_view str, std::byte* out, size_t out_size, size_t& out_len) {
+	if ((str.length() & 1) == 1 || str.length() > out_size * 2) {
+		return false;
+	}
+	size_t olen = str.length() / 2;
+	for (size_t i = 0; i < olen; i++) {
+		int8_t n1 = nibble(str[i * 2]);
+		int8_t n2 = nibble(str[i * 2 + 1]);
+		if (n1 < 0 || n2 < 0) {
+			return false;
+		}
+		out[i] = std::byte{static_cast<uint8_t>((n1 << 4) + n2)};
+	}
+	out_len = olen;
+	return true;
+}
+
 char
 hexchar(int b, bool upper) {
 	if (b >= 0 && b <= 9) {
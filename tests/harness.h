@@ -0,0 +1,318 @@
+#pragma once
+// host test support: a minimal check runner and a scripted Wi-SUN module in front of BRoute
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+// the tests inspect the state machine from the outside
+#define private public
+#define protected public
+#include "BRoute.h"
+#include <esphome/components/api/api_server.h>
+#include <esphome/core/application.h>
+#undef protected
+#undef private
+
+namespace test {
+
+inline int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			::test::failures++; \
+		} \
+	} while (0)
+
+#define CHECK_EQ(a, b) \
+	do { \
+		auto a_ = (a); \
+		auto b_ = (b); \
+		if (!(a_ == b_)) { \
+			std::fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, \
+			             static_cast<long long>(a_), static_cast<long long>(b_)); \
+			::test::failures++; \
+		} \
+	} while (0)
+
+inline std::vector<std::pair<const char*, std::function<void()>>>&
+registry() {
+	static std::vector<std::pair<const char*, std::function<void()>>> tests;
+	return tests;
+}
+
+struct Register {
+	Register(const char* name, std::function<void()> f) { registry().emplace_back(name, std::move(f)); }
+};
+
+#define TEST(name) \
+	static void name(); \
+	static ::test::Register name##_registered(#name, name); \
+	static void name()
+
+// true if a message containing text was logged at that level
+inline bool
+logged(char level, std::string_view text) {
+	return std::any_of(esphome::host::logged.begin(), esphome::host::logged.end(),
+	                   [&](auto& line) { return line[0] == level && line.find(text) != line.npos; });
+}
+
+inline int
+run_all() {
+	for (auto& [name, f] : registry()) {
+		int before = failures;
+		esphome::host::now_us = 0;
+		esphome::host::preferences.clear();
+		esphome::host::scheduler.clear();
+		esphome::host::logged.clear();
+		esphome::App.reboots = 0;
+		esphome::api::global_api_server = nullptr;
+		esphome::host::random_state = 2463534242UL;
+		f();
+		std::printf("%s %s\n", failures == before ? "ok  " : "FAIL", name);
+	}
+	return failures ? 1 : 0;
+}
+
+// ECHONET Lite request as sent by the component
+struct Frame {
+	uint16_t tid;
+	uint8_t deoj[3];
+	uint8_t esv;
+	std::vector<uint8_t> epcs;
+};
+
+// BRoute wired to a fake UART, the test plays the module, by hand or with serve()
+class Module {
+ public:
+	using state_t = esphome::b_route::BRoute::state_t;
+
+	static constexpr const char* METER_MAC = "001D129012345678";
+	static constexpr const char* METER_IP = "FE80:0000:0000:0000:021D:1290:1234:5678";
+	static constexpr const char* OWN_IP = "FE80:0000:0000:0000:021D:1290:0000:0001";
+
+	Module() {
+		b.set_uart_parent(&uart);
+		b.set_rbid("0123456789ABCDEF0123456789ABCDEF", "PASSWORD1234");
+	}
+
+	// lines written to the module since the last call, terminators and SKSENDTO data stripped
+	std::vector<std::string> sent() {
+		take_tx();
+		return std::exchange(tx_lines, {});
+	}
+
+	// true if a command containing text was sent since the last call
+	bool sent_command(std::string_view text) {
+		auto lines = sent();
+		return std::any_of(lines.begin(), lines.end(), [text](auto& l) { return l.find(text) != l.npos; });
+	}
+
+	// ECHONET Lite requests sent with SKSENDTO since the last call
+	std::vector<Frame> requests() {
+		take_tx();
+		return std::exchange(tx_frames, {});
+	}
+
+	// module output, processed by the component before returning
+	void reply(const std::vector<std::string>& lines) {
+		for (auto& line : lines) {
+			b.host_rx.insert(b.host_rx.end(), line.begin(), line.end());
+			b.host_rx.push_back('\r');
+			b.host_rx.push_back('\n');
+		}
+		while (!b.host_rx.empty()) {
+			b.loop();
+		}
+	}
+	void reply(std::initializer_list<std::string_view> lines) { reply(std::vector<std::string>(lines.begin(), lines.end())); }
+
+	// meter response to a request, Get_SNA with empty values for properties missing from `props`
+	std::string rxudp(const Frame& req) const {
+		std::vector<uint8_t> data{0x10, 0x81, static_cast<uint8_t>(req.tid >> 8), static_cast<uint8_t>(req.tid),
+		                          req.deoj[0], req.deoj[1], req.deoj[2], 0x05, 0xff, 0x01, 0x72,
+		                          static_cast<uint8_t>(req.epcs.size())};
+		for (auto epc : req.epcs) {
+			data.push_back(epc);
+			auto found = props.find(epc);
+			if (found == props.end()) {
+				data[10] = 0x52;
+				data.push_back(0);
+				continue;
+			}
+			data.push_back(static_cast<uint8_t>(found->second.size()));
+			data.insert(data.end(), found->second.begin(), found->second.end());
+		}
+		return rxudp(data);
+	}
+
+	std::string rxudp(const std::vector<uint8_t>& data) const {
+		char hex[3];
+		std::string line = std::string("ERXUDP ") + METER_IP + " " + OWN_IP + " 0E1A 0E1A " + METER_MAC + " 1 ";
+		std::snprintf(hex, sizeof(hex), "%02X", static_cast<unsigned>(data.size() >> 8));
+		line += hex;
+		std::snprintf(hex, sizeof(hex), "%02X", static_cast<unsigned>(data.size() & 0xff));
+		line += hex;
+		line += ' ';
+		for (auto byte : data) {
+			std::snprintf(hex, sizeof(hex), "%02X", byte);
+			line += hex;
+		}
+		return line;
+	}
+
+	// plays a BP35 in front of the meter until the component has nothing more to say
+	void serve() {
+		for (;;) {
+			take_tx();
+			if (tx_lines.empty() && tx_frames.empty()) {
+				return;
+			}
+			std::vector<std::string> out;
+			for (auto& cmd : std::exchange(tx_lines, {})) {
+				answer(cmd, out);
+			}
+			for (auto& req : std::exchange(tx_frames, {})) {
+				for (auto epc : req.epcs) {
+					requested[epc]++;
+				}
+				out.emplace_back(std::string("EVENT 21 ") + METER_IP + " 02 00");
+				out.emplace_back("OK");
+				if (!meter_answers || meter_answers()) {
+					out.emplace_back(rxudp(req));
+				}
+			}
+			reply(out);
+		}
+	}
+
+	// advances the clock with the module answering in between
+	void run(uint32_t ms, uint32_t step = 100) {
+		for (uint32_t t = 0; t < ms; t += step) {
+			run_for(std::min(step, ms - t));
+			serve();
+		}
+	}
+
+	// answers of a BP35 that has never been configured, ends scanning
+	void init() {
+		reply({"EVER 1.5.2", "OK", "OK", "OK 01"});
+		reply({"OK", "OK", "OK"});
+	}
+
+	void scan() {
+		reply({"OK", "EVENT 20 FE80:0000:0000:0000:021D:1290:1234:5678", "EPANDESC", "  Channel:21", "  Channel Page:09",
+		       "  Pan ID:8888", "  Addr:001D129012345678", "  LQI:E1", "  PairID:00000000",
+		       "EVENT 22 FE80:0000:0000:0000:021D:1290:0000:0001"});
+		reply({METER_IP});
+		reply({"OK", "OK"});
+	}
+
+	void join() {
+		reply({"OK", "EVENT 21 FE80:0000:0000:0000:021D:1290:1234:5678 00",
+		       "EVENT 25 FE80:0000:0000:0000:021D:1290:1234:5678"});
+	}
+
+	state_t state() const { return b.state; }
+	// ms until the named timeout of the component fires, -1 when not pending
+	int64_t timer(const std::string& name) const { return esphome::host::scheduler.remaining(&b, name); }
+	void run_for(uint32_t ms) { esphome::host::scheduler.run_for(ms); }
+
+	esphome::uart::UARTComponent uart;
+	esphome::b_route::BRoute b;
+
+	// meter property values by EPC, node profile ones included
+	std::map<uint8_t, std::vector<uint8_t>> props{
+	    {0xd3, {0x00, 0x00, 0x00, 0x01}},  // coefficient
+	    {0xd6, {0x01, 0x02, 0x88, 0x01}},  // self-node instance list
+	    {0xe0, {0x00, 0x00, 0x27, 0x10}},  // integral energy
+	    {0xe1, {0x01}},                    // unit 0.1 kWh
+	    {0xe7, {0x00, 0x00, 0x03, 0xe8}},  // 1000 W
+	};
+	// unset: the meter answers every request
+	std::function<bool()> meter_answers;
+	std::string session_lifetime_reg = "00001C20";
+	// time of the last successful SKJOIN/SKREJOIN
+	uint32_t last_join = 0;
+	// requests sent to the meter by EPC, counted by serve()
+	std::map<uint8_t, uint32_t> requested;
+
+ private:
+	void take_tx() {
+		std::string_view tx = b.host_tx;
+		for (;;) {
+			while (!tx.empty() && (tx.front() == '\r' || tx.front() == '\n')) {
+				tx.remove_prefix(1);
+			}
+			if (tx.empty()) {
+				break;
+			}
+			if (tx.rfind("SKSENDTO ", 0) == 0) {
+				// SKSENDTO <HANDLE> <IPADDR> <PORT> <SEC> <DATALEN> <DATA>, the data is not terminated
+				size_t pos = 0;
+				for (int i = 0; i < 6; i++) {
+					pos = tx.find(' ', pos) + 1;
+				}
+				auto len = std::stoul(std::string(tx.substr(pos - 5, 4)), nullptr, 16);
+				tx_lines.emplace_back(tx.substr(0, pos - 1));
+				auto data = reinterpret_cast<const uint8_t*>(tx.data() + pos);
+				Frame frame{static_cast<uint16_t>(data[2] << 8 | data[3]), {data[7], data[8], data[9]}, data[10], {}};
+				for (size_t i = 12; i + 1 < len; i += 2 + data[i + 1]) {
+					frame.epcs.push_back(data[i]);
+				}
+				tx_frames.push_back(frame);
+				tx.remove_prefix(pos + len);
+				continue;
+			}
+			auto end = tx.find_first_of("\r\n");
+			tx_lines.emplace_back(tx.substr(0, end));
+			tx.remove_prefix(end == tx.npos ? tx.size() : end);
+		}
+		b.host_tx.clear();
+	}
+
+	void answer(const std::string& cmd, std::vector<std::string>& out) {
+		if (cmd.rfind("SKSENDTO", 0) == 0) {
+			return;
+		}
+		if (cmd == "SKVER") {
+			out.insert(out.end(), {"EVER 1.5.2", "OK"});
+		} else if (cmd == "SKINFO") {
+			out.insert(out.end(), {std::string("EINFO ") + OWN_IP + " 001D129000000001 21 8888 FFFE", "OK"});
+		} else if (cmd == "SKSREG S16") {
+			out.insert(out.end(), {"ESREG " + session_lifetime_reg, "OK"});
+		} else if (cmd == "ROPT") {
+			out.emplace_back("OK 01");
+		} else if (cmd.rfind("SKSCAN", 0) == 0) {
+			out.insert(out.end(), {"OK", std::string("EVENT 20 ") + METER_IP, "EPANDESC", "  Channel:21", "  Channel Page:09",
+			                       "  Pan ID:8888", std::string("  Addr:") + METER_MAC, "  LQI:E1", "  PairID:00000000",
+			                       std::string("EVENT 22 ") + OWN_IP});
+		} else if (cmd.rfind("SKLL64", 0) == 0) {
+			out.emplace_back(METER_IP);
+		} else if (cmd.rfind("SKJOIN", 0) == 0 || cmd == "SKREJOIN") {
+			last_join = esphome::millis();
+			out.insert(out.end(), {"OK", std::string("EVENT 25 ") + METER_IP});
+		} else {
+			out.emplace_back("OK");
+		}
+	}
+
+	std::vector<std::string> tx_lines;
+	std::vector<Frame> tx_frames;
+};
+
+}  // namespace test
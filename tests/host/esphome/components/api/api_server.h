@@ -0,0 +1,15 @@
+#pragma once
+
+namespace esphome::api {
+
+class APIServer {
+ public:
+	bool is_connected() const { return connected; }
+
+	// whether a Home Assistant client is connected, set by the tests
+	bool connected = true;
+};
+
+inline APIServer* global_api_server = nullptr;
+
+}  // namespace esphome::api
@@ -0,0 +1,29 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "esphome/core/component.h"
+
+namespace esphome::sensor {
+
+class Sensor {
+ public:
+	void publish_state(float value) {
+		state = value;
+		published.push_back(value);
+	}
+	void set_accuracy_decimals(int8_t decimals) { accuracy_decimals = decimals; }
+	int8_t get_accuracy_decimals() { return accuracy_decimals; }
+	const std::string& get_name() const { return name; }
+
+	std::string name;
+	float state = NAN;
+	// every published value, oldest first
+	std::vector<float> published;
+
+ private:
+	int8_t accuracy_decimals = 0;
+};
+
+}  // namespace esphome::sensor
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include "esphome/core/component.h"
+
+namespace esphome::uart {
+
+class UARTComponent {};
+
+class UARTDevice {
+ public:
+	void set_uart_parent(UARTComponent* parent) { parent_ = parent; }
+
+	void write_byte(uint8_t data) { host_tx.push_back(static_cast<char>(data)); }
+	void write_array(const uint8_t* data, size_t len) { host_tx.append(reinterpret_cast<const char*>(data), len); }
+	int available() { return static_cast<int>(host_rx.size()); }
+	bool read_byte(uint8_t* data) {
+		if (host_rx.empty()) {
+			return false;
+		}
+		*data = host_rx.front();
+		host_rx.pop_front();
+		return true;
+	}
+
+	// bytes from the module waiting to be read
+	std::deque<uint8_t> host_rx;
+	// bytes written to the module
+	std::string host_tx;
+
+ protected:
+	UARTComponent* parent_{};
+};
+
+}  // namespace esphome::uart
@@ -0,0 +1,16 @@
+#pragma once
+#include "component.h"
+
+namespace esphome {
+
+class Application {
+ public:
+	void safe_reboot() { reboots++; }
+
+	// counted instead of rebooting the test process
+	int reboots = 0;
+};
+
+inline Application App;
+
+}  // namespace esphome
@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "hal.h"
+#include "log.h"
+
+namespace esphome {
+
+const uint32_t SCHEDULER_DONT_RUN = 4294967295UL;
+
+class Component;
+
+namespace host {
+
+struct Timer {
+	const Component* component;
+	std::string name;
+	bool interval;
+	uint32_t period;
+	uint64_t due_us;
+	std::function<void()> callback;
+	bool removed;
+};
+
+// the timeouts and intervals of every component, fired against the simulated clock
+class Scheduler {
+ public:
+	void set(const Component* component, bool interval, const std::string& name, uint32_t delay,
+	         std::function<void()>&& callback) {
+		if (!name.empty()) {
+			cancel(component, interval, name);
+		}
+		if (delay == SCHEDULER_DONT_RUN) {
+			return;
+		}
+		timers.push_back(std::make_unique<Timer>(
+		    Timer{component, name, interval, delay, now_us + uint64_t{delay} * 1000, std::move(callback), false}));
+	}
+
+	bool cancel(const Component* component, bool interval, const std::string& name) {
+		bool found = false;
+		for (auto& timer : timers) {
+			if (!timer->removed && timer->component == component && timer->interval == interval && timer->name == name) {
+				timer->removed = true;
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	// the pending timer of that name, nullptr when there is none
+	const Timer* find(const Component* component, bool interval, const std::string& name) const {
+		for (auto& timer : timers) {
+			if (!timer->removed && timer->component == component && timer->interval == interval && timer->name == name) {
+				return timer.get();
+			}
+		}
+		return nullptr;
+	}
+
+	// milliseconds until the named timeout fires, -1 when it is not pending
+	int64_t remaining(const Component* component, const std::string& name) const {
+		auto timer = find(component, false, name);
+		return timer ? static_cast<int64_t>((timer->due_us - now_us) / 1000) : -1;
+	}
+
+	// advances the clock by ms, firing everything that falls due on the way in due order
+	void run_for(uint32_t ms) {
+		uint64_t until = now_us + uint64_t{ms} * 1000;
+		for (;;) {
+			Timer* next = nullptr;
+			for (auto& timer : timers) {
+				if (!timer->removed && timer->due_us <= until && (next == nullptr || timer->due_us < next->due_us)) {
+					next = timer.get();
+				}
+			}
+			if (next == nullptr) {
+				break;
+			}
+			now_us = std::max(now_us, next->due_us);
+			// a callback may replace its own timer, keep it alive until it returns
+			auto callback = next->callback;
+			if (next->interval) {
+				next->due_us += uint64_t{next->period} * 1000;
+			} else {
+				next->removed = true;
+			}
+			callback();
+			timers.erase(std::remove_if(timers.begin(), timers.end(), [](auto& timer) { return timer->removed; }),
+			             timers.end());
+		}
+		now_us = until;
+	}
+
+	void clear() { timers.clear(); }
+
+ private:
+	std::vector<std::unique_ptr<Timer>> timers;
+};
+
+inline Scheduler scheduler;
+
+}  // namespace host
+
+class Component {
+ public:
+	virtual ~Component() { host::scheduler.clear(); }
+	virtual void setup() {}
+	virtual void loop() {}
+	void mark_failed() { failed = true; }
+	bool is_failed() const { return failed; }
+
+ protected:
+	void set_interval(const std::string& name, uint32_t interval, std::function<void()>&& f) {
+		host::scheduler.set(this, true, name, interval, std::move(f));
+	}
+	void set_interval(uint32_t interval, std::function<void()>&& f) {
+		host::scheduler.set(this, true, "", interval, std::move(f));
+	}
+	void set_timeout(const std::string& name, uint32_t timeout, std::function<void()>&& f) {
+		host::scheduler.set(this, false, name, timeout, std::move(f));
+	}
+	void set_timeout(uint32_t timeout, std::function<void()>&& f) {
+		host::scheduler.set(this, false, "", timeout, std::move(f));
+	}
+	bool cancel_timeout(const std::string& name) { return host::scheduler.cancel(this, false, name); }
+	bool cancel_interval(const std::string& name) { return host::scheduler.cancel(this, true, name); }
+
+ private:
+	bool failed = false;
+};
+
+}  // namespace esphome
@@ -0,0 +1,8 @@
+#pragma once
+#define USE_API
+// what the code generator emits for a configuration with every measurement feature
+#define USE_B_ROUTE_POWER
+#define USE_B_ROUTE_POWER_STATS
+#define USE_B_ROUTE_ENERGY
+#define USE_B_ROUTE_DEMAND
+#define USE_B_ROUTE_PROPERTIES
@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+
+namespace esphome {
+
+namespace host {
+// simulated time, only advanced by the tests
+inline uint64_t now_us = 0;
+}  // namespace host
+
+inline uint32_t
+millis() {
+	return static_cast<uint32_t>(host::now_us / 1000);
+}
+
+inline uint32_t
+micros() {
+	return static_cast<uint32_t>(host::now_us);
+}
+
+inline void
+delay(uint32_t ms) {
+	host::now_us += uint64_t{ms} * 1000;
+}
+
+}  // namespace esphome
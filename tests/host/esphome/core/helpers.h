@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace esphome {
+
+inline uint32_t
+fnv1_hash(const std::string& str) {
+	uint32_t hash = 2166136261UL;
+	for (char c : str) {
+		hash *= 16777619UL;
+		hash ^= static_cast<uint8_t>(c);
+	}
+	return hash;
+}
+
+namespace host {
+// xorshift32, reseeded by the tests for reproducible jitter
+inline uint32_t random_state = 2463534242UL;
+}  // namespace host
+
+inline uint32_t
+random_uint32() {
+	auto& x = host::random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+class HighFrequencyLoopRequester {
+ public:
+	void start() { started = true; }
+	void stop() { started = false; }
+	bool is_started() const { return started; }
+
+ private:
+	bool started = false;
+};
+
+template <typename... X>
+class CallbackManager;
+
+template <typename... Ts>
+class CallbackManager<void(Ts...)> {
+ public:
+	void add(std::function<void(Ts...)>&& callback) { callbacks.push_back(std::move(callback)); }
+	void call(Ts... args) {
+		for (auto& callback : callbacks) {
+			callback(args...);
+		}
+	}
+
+ private:
+	std::vector<std::function<void(Ts...)>> callbacks;
+};
+
+template <typename T>
+class Parented {
+ public:
+	void set_parent(T* parent) { parent_ = parent; }
+
+ protected:
+	T* parent_{};
+};
+
+}  // namespace esphome
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdarg>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace esphome::host {
+
+// set by the tests to see the component log on stderr
+inline bool verbose = false;
+// every message logged, "<level> <message>"
+inline std::vector<std::string> logged;
+
+inline void
+log(char level, const char* tag, const char* fmt, ...) {
+	char message[256];
+	va_list args;
+	va_start(args, fmt);
+	std::vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+	logged.push_back(std::string(1, level) + " " + message);
+	if (verbose) {
+		std::fprintf(stderr, "[%c][%s] %s\n", level, tag, message);
+	}
+}
+
+}  // namespace esphome::host
+
+#define ESP_LOGE(tag, ...) ::esphome::host::log('E', tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) ::esphome::host::log('W', tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) ::esphome::host::log('I', tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) ::esphome::host::log('D', tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) ::esphome::host::log('V', tag, __VA_ARGS__)
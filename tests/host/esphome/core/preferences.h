@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace esphome {
+
+namespace host {
+// flash contents by key, survives the component instances of a test
+inline std::map<uint32_t, std::vector<uint8_t>> preferences;
+}  // namespace host
+
+class ESPPreferenceObject {
+ public:
+	ESPPreferenceObject() = default;
+	explicit ESPPreferenceObject(uint32_t key) : key(key), valid(true) {}
+
+	template <typename T>
+	bool save(const T* src) {
+		if (!valid) {
+			return false;
+		}
+		auto bytes = reinterpret_cast<const uint8_t*>(src);
+		host::preferences[key].assign(bytes, bytes + sizeof(T));
+		return true;
+	}
+
+	template <typename T>
+	bool load(T* dest) {
+		auto found = host::preferences.find(key);
+		if (!valid || found == host::preferences.end() || found->second.size() != sizeof(T)) {
+			return false;
+		}
+		std::memcpy(dest, found->second.data(), sizeof(T));
+		return true;
+	}
+
+ private:
+	uint32_t key = 0;
+	bool valid = false;
+};
+
+class ESPPreferences {
+ public:
+	template <typename T>
+	ESPPreferenceObject make_preference(uint32_t key, bool) {
+		return ESPPreferenceObject(key);
+	}
+};
+
+inline ESPPreferences host_preferences;
+inline ESPPreferences* global_preferences = &host_preferences;
+
+}  // namespace esphome
@@ -0,0 +1,122 @@
+// integral energy scaling (energy::Scale) and counter wraparound
+#include "harness.h"
+
+using energy::Scale;
+using test::Module;
+
+namespace {
+
+Scale
+make_scale(uint32_t coefficient, uint8_t unit) {
+	Scale s;
+	s.set_coefficient(coefficient);
+	CHECK(s.set_unit(unit));
+	return s;
+}
+
+}  // namespace
+
+TEST(unit_codes) {
+	struct {
+		uint8_t code;
+		int8_t exponent;
+	} codes[] = {{0x00, 0},  {0x01, -1}, {0x02, -2}, {0x03, -3}, {0x04, -4},
+	             {0x0a, 1},  {0x0b, 2},  {0x0c, 3},  {0x0d, 4}};
+	for (auto& c : codes) {
+		auto s = make_scale(1, c.code);
+		CHECK(s.ready());
+		CHECK_EQ(s.exponent(), c.exponent);
+		CHECK_EQ(s.decimals(), c.exponent < 0 ? -c.exponent : 0);
+	}
+	Scale s;
+	for (uint8_t code : {0x05, 0x09, 0x0e, 0xff}) {
+		CHECK(!s.set_unit(code));
+	}
+	CHECK(!s.ready());
+}
+
+TEST(unit_10_kwh) {
+	// 0x0A is 10 kWh, not 10^-10 kWh
+	auto s = make_scale(1, 0x0a);
+	CHECK(s.kwh(12345) == 123450.0);
+	CHECK(s.to_kwh(99999999) == 999999990.0f);
+	CHECK_EQ(s.decimals(), 0);
+}
+
+TEST(coefficient_zeros_move_to_exponent) {
+	auto s = make_scale(1000, 0x02);
+	CHECK_EQ(s.multiplier(), 1u);
+	CHECK_EQ(s.exponent(), 1);
+	CHECK(s.kwh(7) == 70.0);
+	// an unset or zero coefficient is 1
+	s.set_coefficient(0);
+	CHECK_EQ(s.multiplier(), 1u);
+	CHECK_EQ(s.exponent(), -2);
+}
+
+TEST(full_counter_range) {
+	// largest coefficient (6 digits) and counter (8 digits) stay exact
+	auto s = make_scale(999999, 0x04);
+	CHECK_EQ(s.scaled(99999999), 99999999ull * 999999);
+	CHECK(s.kwh(99999999) == 99999999.0 * 999999 / 1e4);
+	// every reading of a 0.1 kWh meter is correctly rounded and never goes backwards
+	auto t = make_scale(1, 0x01);
+	float prev = -1;
+	bool monotonic = true;
+	bool exact = true;
+	for (uint32_t counter = 0; counter <= 99'999'999; counter++) {
+		auto v = t.to_kwh(counter);
+		monotonic = monotonic && v >= prev;
+		prev = v;
+		if (counter % 9'973 == 0) {
+			exact = exact && t.kwh(counter) == counter / 10.0;
+		}
+	}
+	CHECK(monotonic);
+	CHECK(exact);
+	CHECK(t.kwh(99'999'999) == 9'999'999.9);
+}
+
+TEST(counter_wraparound_is_logged) {
+	Module m;
+	esphome::sensor::Sensor energy;
+	m.b.set_energy_sensor(&energy);
+	m.b.set_energy_sensor_interval_sec(60);
+	m.props[0xe0] = {0x05, 0xf5, 0xe0, 0xff};  // 99999999
+	m.b.setup();
+	m.run(70'000);
+	CHECK(!energy.published.empty());
+	CHECK(energy.state == 9'999'999.9f);
+	CHECK(!test::logged('W', "wrapped"));
+	m.props[0xe0] = {0x00, 0x00, 0x00, 0x00};
+	m.run(60'000);
+	CHECK(test::logged('W', "Energy counter wrapped around (99999999 -> 0)"));
+	CHECK(energy.state == 0.0f);
+}
+
+TEST(meter_clock_only_when_needed) {
+	Module plain;
+	esphome::sensor::Sensor energy;
+	plain.b.set_energy_sensor(&energy);
+	plain.b.set_energy_sensor_interval_sec(60);
+	plain.b.setup();
+	plain.run(600'000);
+	CHECK(!energy.published.empty());
+	CHECK_EQ(plain.requested[0x97], 0u);
+	CHECK_EQ(plain.requested[0x98], 0u);
+	CHECK(plain.timer("clock") < 0);
+
+	Module aligned;
+	aligned.b.set_energy_sensor(&energy);
+	aligned.b.set_energy_sensor_interval_sec(60);
+	aligned.b.set_energy_slot_aligned(true);
+	aligned.b.setup();
+	aligned.run(60'000);
+	CHECK(aligned.requested[0x97] > 0u);
+	CHECK(aligned.timer("clock") >= 0);
+}
+
+int
+main() {
+	return test::run_all();
+}
@@ -0,0 +1,80 @@
+// offline buffer: live publishing while the API is away, replay with the reading age afterwards
+#include "harness.h"
+
+using test::Module;
+
+namespace {
+
+struct Replayed {
+	std::string name;
+	float value;
+	uint32_t age;
+};
+
+}  // namespace
+
+TEST(sensors_stay_live_while_disconnected) {
+	Module m;
+	esphome::api::APIServer api;
+	esphome::api::global_api_server = &api;
+	esphome::sensor::Sensor power;
+	power.name = "power";
+	std::vector<Replayed> replayed;
+	m.b.set_power_sensor(&power);
+	m.b.set_power_sensor_interval_sec(10);
+	m.b.set_offline_buffer(1024, 100);
+	m.b.add_on_replay_callback([&replayed](std::string name, float value, uint32_t age) {
+		replayed.push_back({name, value, age});
+	});
+	m.b.setup();
+	m.run(30'000);
+	CHECK(!power.published.empty());
+
+	api.connected = false;
+	auto before = power.published.size();
+	m.props[0xe7] = {0x00, 0x00, 0x01, 0xf4};
+	m.run(60'000);
+	auto during = power.published.size() - before;
+	// on-device consumers see every reading as it arrives
+	CHECK(during >= 5);
+	CHECK(power.state == 500.0f);
+	CHECK(replayed.empty());
+	CHECK_EQ(m.b.offline_readings.size(), during);
+
+	m.props[0xe7] = {0x00, 0x00, 0x02, 0x58};
+	api.connected = true;
+	m.run(5'000);
+	CHECK_EQ(replayed.size(), during);
+	CHECK(m.b.offline_readings.empty());
+	for (size_t i = 0; i < replayed.size(); i++) {
+		CHECK(replayed[i].name == "power");
+		CHECK(replayed[i].value == 500.0f);
+		// oldest first, each one carrying how long ago it was measured
+		CHECK(i == 0 || replayed[i].age <= replayed[i - 1].age);
+	}
+	CHECK(!replayed.empty() && replayed.front().age >= 45 && replayed.back().age <= 10);
+	// the replay does not go through the sensor again
+	CHECK(std::count(power.published.begin() + before + during, power.published.end(), 500.0f) == 0);
+}
+
+TEST(no_buffering_while_connected) {
+	Module m;
+	esphome::api::APIServer api;
+	esphome::api::global_api_server = &api;
+	esphome::sensor::Sensor power;
+	int replays = 0;
+	m.b.set_power_sensor(&power);
+	m.b.set_power_sensor_interval_sec(10);
+	m.b.set_offline_buffer(1024, 100);
+	m.b.add_on_replay_callback([&replays](std::string, float, uint32_t) { replays++; });
+	m.b.setup();
+	m.run(60'000);
+	CHECK(!power.published.empty());
+	CHECK(m.b.offline_readings.empty());
+	CHECK_EQ(replays, 0);
+}
+
+int
+main() {
+	return test::run_all();
+}
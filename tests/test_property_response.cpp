@@ -0,0 +1,76 @@
+// property responses: decoding of Get_Res and partial Get_SNA frames
+#include "harness.h"
+
+using esphome::b_route::PropertyDef;
+using test::Module;
+
+TEST(get_sna_keeps_readable_properties) {
+	// requested together in one frame, the meter only knows E8
+	static constexpr PropertyDef defs[] = {{0xe8, 4, false, 1.0f, 60'000}, {0xe9, 2, false, 1.0f, 60'000}};
+	Module m;
+	esphome::sensor::Sensor current;
+	esphome::sensor::Sensor missing;
+	m.b.set_properties(defs, 2);
+	m.b.set_property_sensor(0, &current);
+	m.b.set_property_sensor(1, &missing);
+	m.props[0xe8] = {0x00, 0x01, 0x00, 0x02};
+	m.b.setup();
+	m.run(70'000);
+	CHECK(m.state() == Module::state_t::running);
+	CHECK(!current.published.empty());
+	CHECK(current.state == float(0x00010002));
+	CHECK(missing.published.empty());
+}
+
+TEST(get_sna_with_power) {
+	Module m;
+	esphome::sensor::Sensor power;
+	m.b.set_power_sensor(&power);
+	m.b.set_power_sensor_interval_sec(3600);
+	m.b.setup();
+	m.serve();
+	CHECK(m.state() == Module::state_t::running);
+	// 500 W and an unavailable property in the same Get_SNA
+	m.reply({m.rxudp({0x10, 0x81, 0x12, 0x34, 0x02, 0x88, 0x01, 0x05, 0xff, 0x01, 0x52, 0x02, 0xe7, 0x04, 0x00, 0x00, 0x01,
+	                  0xf4, 0xe8, 0x00})});
+	CHECK(power.state == 500.0f);
+}
+
+TEST(unavailable_coefficient_is_one) {
+	Module m;
+	esphome::sensor::Sensor energy;
+	m.b.set_energy_sensor(&energy);
+	m.b.set_energy_sensor_interval_sec(60);
+	// no D3: the coefficient comes back in a Get_SNA next to the unit
+	m.props.erase(0xd3);
+	m.b.setup();
+	m.run(70'000);
+	CHECK(m.b.energy_scale.ready());
+	CHECK(!energy.published.empty());
+	// 10000 * 0.1 kWh
+	CHECK(std::fabs(energy.state - 1000.0f) < 0.01f);
+}
+
+TEST(malformed_property_map_keeps_known_one) {
+	Module m;
+	esphome::sensor::Sensor power;
+	m.b.set_power_sensor(&power);
+	m.b.set_power_sensor_interval_sec(10);
+	m.props[0x9f] = {0x03, 0x9f, 0xd3, 0xe7};
+	m.b.setup();
+	m.run(30'000);
+	CHECK(m.b.property_map_known);
+	CHECK(m.b.property_map.has(0xe7));
+	// five properties announced, one listed
+	m.reply({m.rxudp({0x10, 0x81, 0x12, 0x34, 0x02, 0x88, 0x01, 0x05, 0xff, 0x01, 0x72, 0x01, 0x9f, 0x02, 0x05, 0xe7})});
+	CHECK(test::logged('W', "Invalid property map (2 bytes)"));
+	CHECK(m.b.property_map.has(0xe7));
+	auto readings = power.published.size();
+	m.run(20'000);
+	CHECK(power.published.size() > readings);
+}
+
+int
+main() {
+	return test::run_all();
+}
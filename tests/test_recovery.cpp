@@ -0,0 +1,81 @@
+// recovery policies: time from the end of an outage to the next reading, fixed against backoff
+#include "harness.h"
+
+using esphome::b_route::RecoveryPolicyType;
+using test::Module;
+
+namespace {
+
+struct Outcome {
+	uint32_t latency;  // ms from the end of the outage to the first reading after it
+	uint32_t actions;  // rejoins, rescans and module resets during the outage
+};
+
+// the meter drops every request from `start` on, until a session is set up after the outage has ended
+Outcome
+outage(RecoveryPolicyType policy, uint32_t duration) {
+	Module m;
+	esphome::sensor::Sensor power;
+	m.b.set_power_sensor(&power);
+	m.b.set_power_sensor_interval_sec(10);
+	m.b.set_rejoin_timeout_sec(120);
+	m.b.set_rescan_timeout_sec(240);
+	m.b.set_module_reset_timeout_sec(300);
+	// restart_timeout: 0s, the default; a healthy module is never rebooted
+	m.b.set_restart_timeout_sec(0);
+	m.b.set_recovery_policy(policy);
+	m.b.setup();
+	m.run(60'000);
+	CHECK(m.state() == Module::state_t::running);
+	CHECK(!power.published.empty());
+
+	uint32_t start = esphome::millis();
+	uint32_t end = start + duration;
+	m.meter_answers = [&m, start, end] {
+		auto now = esphome::millis();
+		return now < start || m.last_join >= end;
+	};
+	m.run(duration);
+	auto readings = power.published.size();
+	auto& c = m.b.recovery_counters;
+	Outcome out{0, c.rejoins + c.rescans + c.module_resets};
+	while (power.published.size() == readings && out.latency < 7'200'000) {
+		m.run(1'000);
+		out.latency += 1'000;
+	}
+	CHECK(m.state() == Module::state_t::running);
+	CHECK_EQ(esphome::App.reboots, 0);
+	return out;
+}
+
+}  // namespace
+
+TEST(short_outage) {
+	auto fixed = outage(RecoveryPolicyType::fixed, 90'000);
+	auto backoff = outage(RecoveryPolicyType::backoff, 90'000);
+	std::printf("     90 s outage: fixed %u s (%u actions), backoff %u s (%u actions)\n", fixed.latency / 1000,
+	            fixed.actions, backoff.latency / 1000, backoff.actions);
+	// first rejoin 120 s after the last reading, +20% jitter for backoff, plus the 10 s request interval
+	CHECK(fixed.latency <= 30'000 + 10'000);
+	CHECK(backoff.latency <= 54'000 + 10'000);
+	CHECK_EQ(fixed.actions, 0u);
+	CHECK_EQ(backoff.actions, 0u);
+}
+
+TEST(long_outage) {
+	auto fixed = outage(RecoveryPolicyType::fixed, 2'400'000);
+	auto backoff = outage(RecoveryPolicyType::backoff, 2'400'000);
+	std::printf("     40 min outage: fixed %u s (%u actions), backoff %u s (%u actions)\n", fixed.latency / 1000,
+	            fixed.actions, backoff.latency / 1000, backoff.actions);
+	// fixed keeps acting at least every rejoin_timeout
+	CHECK(fixed.latency <= 120'000 + 10'000);
+	// backoff trades a later recovery, at most the 30 min cap +20%, for far fewer actions
+	CHECK(backoff.latency > fixed.latency);
+	CHECK(backoff.latency <= 2'160'000 + 10'000);
+	CHECK(backoff.actions * 3 < fixed.actions);
+}
+
+int
+main() {
+	return test::run_all();
+}
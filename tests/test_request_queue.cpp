@@ -0,0 +1,103 @@
+// Get request queue: coalescing by EPC membership and freshness limits
+#include "harness.h"
+
+using test::Module;
+
+namespace {
+
+size_t
+pending(const Module& m) {
+	return std::count_if(m.b.request_queue.begin(), m.b.request_queue.end(), [](auto& r) { return r.used; });
+}
+
+const uint8_t POWER_ENERGY[] = {0xe7, 0xe0};
+const uint8_t ENERGY[] = {0xe0};
+const uint8_t POWER[] = {0xe7};
+
+}  // namespace
+
+TEST(subset_joins_pending_request) {
+	// not running, requests wait in the queue
+	Module m;
+	m.b.enqueue_request(POWER_ENERGY, 2, 1, 0, false);
+	m.b.enqueue_request(ENERGY, 1, 2, 0, false);
+	CHECK_EQ(pending(m), 1u);
+	auto& r = m.b.request_queue[0];
+	CHECK_EQ(r.count, 2);
+	CHECK_EQ(r.priority, 2);
+}
+
+TEST(pending_request_grows_into_superset) {
+	Module m;
+	m.b.enqueue_request(ENERGY, 1, 1, 0, false);
+	m.b.enqueue_request(POWER_ENERGY, 2, 1, 0, false);
+	CHECK_EQ(pending(m), 1u);
+	auto& r = m.b.request_queue[0];
+	CHECK_EQ(r.count, 2);
+	CHECK(r.epcs[0] == 0xe7 && r.epcs[1] == 0xe0);
+}
+
+TEST(disjoint_requests_stay_apart) {
+	Module m;
+	m.b.enqueue_request(ENERGY, 1, 1, 0, false);
+	m.b.enqueue_request(POWER, 1, 1, 0, false);
+	// the node profile is another object, the same EPC there is another request
+	m.b.enqueue_request(POWER, 1, 1, 0, true);
+	CHECK_EQ(pending(m), 3u);
+}
+
+TEST(stricter_max_age_wins) {
+	Module m;
+	m.b.enqueue_request(POWER, 1, 1, 0, false);
+	m.b.enqueue_request(POWER, 1, 1, 10'000, false);
+	CHECK_EQ(m.b.request_queue[0].max_age, 10'000u);
+	m.b.enqueue_request(POWER, 1, 1, 5'000, false);
+	CHECK_EQ(m.b.request_queue[0].max_age, 5'000u);
+	m.b.enqueue_request(POWER, 1, 1, 20'000, false);
+	CHECK_EQ(m.b.request_queue[0].max_age, 5'000u);
+	m.b.enqueue_request(POWER, 1, 1, 0, false);
+	CHECK_EQ(m.b.request_queue[0].max_age, 5'000u);
+	CHECK_EQ(pending(m), 1u);
+}
+
+TEST(inflight_request_serves_subset) {
+	Module m;
+	m.b.setup();
+	m.serve();
+	CHECK(m.state() == Module::state_t::running);
+	m.run(5'000);
+	m.b.enqueue_request(POWER_ENERGY, 2, 1, 0, false);
+	auto sent = m.requests();
+	CHECK(sent.size() == 1 && sent[0].epcs.size() == 2);
+	CHECK(m.b.awaiting_response);
+	// answered by the request already on the air, nothing more is sent
+	m.b.enqueue_request(POWER, 1, 1, 0, false);
+	CHECK_EQ(pending(m), 1u);
+	m.reply({m.rxudp(sent[0])});
+	m.run(5'000);
+	CHECK(m.requests().empty());
+	CHECK_EQ(pending(m), 0u);
+}
+
+TEST(abandoned_send_lowers_response_rate) {
+	Module m;
+	m.b.setup();
+	m.serve();
+	CHECK(m.state() == Module::state_t::running);
+	m.run(5'000);
+	auto rate = m.b.link_success_fast.value();
+	m.b.enqueue_request(POWER, 1, 1, 0, false);
+	CHECK_EQ(m.requests().size(), 1u);
+	// the module fails to send the request and each retransmit
+	for (int i = 0; i <= 3; i++) {
+		m.reply({std::string("EVENT 21 ") + Module::METER_IP + " 02 01"});
+	}
+	CHECK(test::logged('W', "Send failed 4 times, give up"));
+	CHECK(!m.b.awaiting_response);
+	CHECK(m.b.link_success_fast.value() < rate);
+}
+
+int
+main() {
+	return test::run_all();
+}
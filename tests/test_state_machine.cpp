@@ -0,0 +1,182 @@
+// connection state machine: events through TRANSITIONS/dispatch, states and deadlines
+#include "harness.h"
+
+using test::Module;
+using state_t = Module::state_t;
+
+TEST(init_scan_join) {
+	Module m;
+	m.b.setup();
+	CHECK(m.state() == state_t::wait_ver);
+	CHECK_EQ(m.timer("state"), 1'000);
+	auto sent = m.sent();
+	CHECK(sent.size() == 3 && sent[0] == "SKVER" && sent[1] == "SKSREG SFE 0" && sent[2] == "ROPT");
+
+	m.reply({"EVER 1.5.2", "OK"});
+	CHECK(m.state() == state_t::setting_values);
+	CHECK_EQ(m.timer("state"), 1'000);
+	m.reply({"OK", "OK 01"});
+	sent = m.sent();
+	CHECK(sent.size() == 3 && sent[0].rfind("SKSETPWD 0C ", 0) == 0 && sent[1].rfind("SKSETRBID ", 0) == 0 &&
+	      sent[2] == "SKSREG S16");
+	m.reply({"OK", "OK", "OK"});
+	CHECK(m.state() == state_t::scanning);
+	CHECK_EQ(m.timer("state"), 20'000);
+	CHECK(m.sent_command("SKSCAN 2 FFFFFFFF 6"));
+
+	m.scan();
+	CHECK(m.state() == state_t::joining);
+	CHECK_EQ(m.timer("state"), 10'000);
+	CHECK(m.sent_command(std::string("SKJOIN ") + Module::METER_IP));
+
+	m.join();
+	CHECK(m.state() == state_t::running);
+	CHECK_EQ(m.timer("state"), -1);
+	// default 2 h lifetime, 10 % margin capped to 10 min
+	CHECK_EQ(m.timer("reauth"), 7'200'000 - 600'000);
+	CHECK_EQ(m.timer("reauth_deadline"), 7'200'000 - 300'000);
+}
+
+TEST(unhandled_input_keeps_state) {
+	Module m;
+	m.b.setup();
+	m.init();
+	m.run_for(5'000);
+	m.reply({"EVENT 25 FE80:0000:0000:0000:021D:1290:1234:5678", "EINFO x", "garbage"});
+	CHECK(m.state() == state_t::scanning);
+	CHECK_EQ(m.timer("state"), 15'000);
+}
+
+TEST(scan_timeout_restarts_init) {
+	Module m;
+	m.b.setup();
+	m.init();
+	m.sent();
+	m.run_for(19'999);
+	CHECK(m.state() == state_t::scanning);
+	m.run_for(1);
+	CHECK(m.state() == state_t::wait_ver);
+	CHECK_EQ(m.timer("state"), 1'000);
+	CHECK(m.sent_command("SKVER"));
+}
+
+TEST(empty_scan_scans_again) {
+	Module m;
+	m.b.setup();
+	m.init();
+	m.sent();
+	m.run_for(10'000);
+	m.reply({"OK", "EVENT 22 FE80:0000:0000:0000:021D:1290:0000:0001"});
+	CHECK(m.state() == state_t::scanning);
+	// a fresh scan gets the full deadline
+	CHECK_EQ(m.timer("state"), 20'000);
+	CHECK(m.sent_command("SKSCAN"));
+}
+
+TEST(join_failure_rescans) {
+	Module m;
+	m.b.setup();
+	m.init();
+	m.scan();
+	m.reply({"OK", "EVENT 24 FE80:0000:0000:0000:021D:1290:1234:5678"});
+	CHECK(m.state() == state_t::scanning);
+	CHECK_EQ(m.timer("state"), 20'000);
+	CHECK(m.b.is_pan_blacklisted(m.b.pan_selected.addr));
+}
+
+TEST(session_expiry_waits_for_rejoin) {
+	Module m;
+	m.b.setup();
+	m.init();
+	m.scan();
+	m.join();
+	m.run_for(60'000);
+	m.reply({"EVENT 29 FE80:0000:0000:0000:021D:1290:1234:5678"});
+	CHECK(m.state() == state_t::joining);
+	CHECK_EQ(m.timer("state"), 10'000);
+	m.reply({"EVENT 25 FE80:0000:0000:0000:021D:1290:1234:5678"});
+	CHECK(m.state() == state_t::running);
+	// deadlines restart from the new session
+	CHECK_EQ(m.timer("reauth"), 7'200'000 - 600'000);
+}
+
+TEST(reauth_before_expiry) {
+	Module m;
+	m.b.setup();
+	m.init();
+	m.scan();
+	m.join();
+	m.sent();
+	m.run_for(7'200'000 - 600'000);
+	CHECK(m.state() == state_t::reauth);
+	CHECK_EQ(m.timer("state"), 10'000);
+	CHECK_EQ(m.timer("reauth_deadline"), -1);
+	CHECK(m.sent_command("SKREJOIN"));
+	m.reply({"OK", "EVENT 25 FE80:0000:0000:0000:021D:1290:1234:5678"});
+	CHECK(m.state() == state_t::running);
+}
+
+TEST(learned_session_lifetime) {
+	Module m;
+	// ESREG answer to SKSREG S16, 600 s
+	m.session_lifetime_reg = "00000258";
+	m.b.setup();
+	m.serve();
+	CHECK(m.state() == state_t::running);
+	CHECK_EQ(m.b.session_lifetime, 600'000u);
+	// 10 % margin, at least a minute
+	CHECK_EQ(m.timer("reauth"), 600'000 - 60'000);
+	CHECK_EQ(m.timer("reauth_deadline"), 600'000 - 30'000);
+	m.sent();
+	m.run_for(540'000);
+	CHECK(m.state() == state_t::reauth);
+	CHECK(m.sent_command("SKREJOIN"));
+}
+
+TEST(unresponsive_module_is_reset_then_rebooted) {
+	Module m;
+	m.b.setup();
+	m.sent();
+	// each silent SKVER is retried once a second
+	m.run_for(1'000);
+	CHECK(m.state() == state_t::wait_ver);
+	m.run_for(1'000);
+	CHECK(m.state() == state_t::wait_ver);
+	m.sent();
+	m.run_for(1'000);
+	CHECK(m.state() == state_t::resetting);
+	CHECK_EQ(m.timer("state"), 3'000);
+	CHECK(m.sent_command("SKRESET"));
+	m.run_for(3'000);
+	CHECK(m.state() == state_t::wait_ver);
+	m.run_for(3'000);
+	CHECK(m.state() == state_t::restarting);
+	CHECK_EQ(esphome::App.reboots, 0);
+	m.run_for(5'000);
+	CHECK_EQ(esphome::App.reboots, 1);
+	CHECK(m.b.is_failed());
+}
+
+TEST(version_answer_clears_module_fault) {
+	Module m;
+	m.b.setup();
+	m.run_for(2'000);
+	m.reply({"EVER 1.5.2", "OK"});
+	CHECK(m.state() == state_t::setting_values);
+	CHECK_EQ(m.b.module_unresponsive, 0);
+}
+
+TEST(meter_preference_keys) {
+	Module m;
+	m.b.setup();
+	m.run(10'000);
+	CHECK(m.state() == state_t::running);
+	// same keys as before they were hashed without a string, flash entries stay valid
+	CHECK_EQ(m.b.meter_eoj_key, esphome::fnv1_hash(std::string("b_route_meter_eoj_") + Module::METER_MAC));
+	CHECK_EQ(m.b.property_map_key, esphome::fnv1_hash(std::string("b_route_property_map_") + Module::METER_MAC));
+}
+
+int
+main() {
+	return test::run_all();
+}
@@ -0,0 +1,427 @@
+#!/usr/bin/env python3
+"""BP35 (SKSTACK IP) + low-voltage smart meter emulator with fault injection.
+
+Speaks the subset of the SK command set used by the b_route component and
+answers ECHONET Lite Get requests like a low-voltage smart meter (0x028801).
+Run it on a pty, or on a USB-serial adapter wired to the ESP UART in place of
+the Wi-SUN module, and leave it running to soak-test recovery:
+
+    tools/bp35_emulator.py --device /dev/ttyUSB0 --loss 0.2 --session-lifetime 600
+
+Faults are scaled by --time-scale, so `--time-scale 10` makes every emulator
+interval (session lifetime, outages, rate limits, ...) ten times shorter.
+On exit (Ctrl-C) and every --report seconds it prints the number of data gaps
+longer than --gap and the mean/max time to recovery.
+"""
+
+import argparse
+import heapq
+import itertools
+import os
+import random
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+METER_MAC = "001D129012345678"
+METER_PANID = "8888"
+METER_CHANNEL = "21"
+OWN_IP = "FE80:0000:0000:0000:021D:1290:0000:0001"
+EL_PORT = 3610
+
+EOJ_METER = bytes([0x02, 0x88, 0x01])
+EOJ_NODE_PROFILE = bytes([0x0E, 0xF0, 0x01])
+
+ESV_GET = 0x62
+ESV_GET_RES = 0x72
+ESV_GET_SNA = 0x52
+
+DEFAULT_REGS = {0x02: "21", 0x03: "FFFF", 0xFE: "1", 0x16: "00001C20"}
+
+
+def mac_to_ipv6(mac):
+    b = bytearray.fromhex(mac)
+    b[0] ^= 0x02
+    return "FE80:0000:0000:0000:" + ":".join(b[i : i + 2].hex().upper() for i in range(0, 8, 2))
+
+
+METER_IP = mac_to_ipv6(METER_MAC)
+
+
+class Stats:
+    def __init__(self, gap):
+        self.gap = gap
+        self.requests = 0
+        self.answered = 0
+        self.dropped = 0
+        self.send_failed = 0
+        self.last_answer = None
+        self.recoveries = []
+
+    def answer(self, now):
+        self.answered += 1
+        if self.last_answer is not None and now - self.last_answer > self.gap:
+            self.recoveries.append(now - self.last_answer)
+        self.last_answer = now
+
+    def report(self):
+        r = self.recoveries
+        mttr = sum(r) / len(r) if r else 0
+        return (
+            f"requests={self.requests} answered={self.answered} dropped={self.dropped} "
+            f"send_failed={self.send_failed} gaps={len(r)} mttr={mttr:.1f}s max={max(r, default=0):.1f}s"
+        )
+
+
+class Meter:
+    """ECHONET Lite low-voltage smart meter object."""
+
+    def __init__(self, args):
+        self.args = args
+        self.energy = args.initial_energy
+        self.power = 500
+        self.energy_acc = 0.0
+        self.last_update = time.monotonic()
+
+    def update(self):
+        now = time.monotonic()
+        dt = now - self.last_update
+        self.last_update = now
+        self.power = max(0, min(6000, self.power + random.randint(-200, 200)))
+        # 0.1kWh unit
+        self.energy_acc += self.power * dt / 3600 / 100
+        while self.energy_acc >= 1:
+            self.energy_acc -= 1
+            self.energy = (self.energy + 1) % 100000000
+
+    def property(self, deoj, epc):
+        self.update()
+        lt = time.localtime()
+        if deoj[:2] == EOJ_NODE_PROFILE[:2]:
+            if epc in (0xD5, 0xD6):
+                return bytes([1]) + bytes([0x02, 0x88, self.args.instance])
+            return None
+        if deoj[:2] != EOJ_METER[:2] or deoj[2] not in (0, self.args.instance):
+            return None
+        if epc == 0xD3:
+            return struct.pack(">I", 1)
+        if epc == 0xE1:
+            return bytes([0x01])
+        if epc == 0xE0:
+            return struct.pack(">I", self.energy)
+        if epc == 0xE7:
+            return struct.pack(">i", self.power)
+        if epc == 0xEA:
+            m = lt.tm_min - lt.tm_min % 30
+            return struct.pack(">HBBBBBI", lt.tm_year, lt.tm_mon, lt.tm_mday, lt.tm_hour, m, 0, self.energy)
+        if epc == 0x97:
+            return bytes([lt.tm_hour, lt.tm_min])
+        if epc == 0x98:
+            return struct.pack(">HBB", lt.tm_year, lt.tm_mon, lt.tm_mday)
+        if epc == 0x9F:
+            epcs = [0x80, 0x88, 0x8A, 0x97, 0x98, 0x9D, 0x9E, 0x9F, 0xD3, 0xD7, 0xE0, 0xE1, 0xE7, 0xEA]
+            if len(epcs) < 16:
+                return bytes([len(epcs)] + epcs)
+            bitmap = bytearray(16)
+            for e in epcs:
+                bitmap[e & 0x0F] |= 1 << ((e >> 4) - 8)
+            return bytes([len(epcs)]) + bytes(bitmap)
+        return None
+
+    def handle(self, frame):
+        if len(frame) < 12 or frame[0] != 0x10 or frame[1] != 0x81 or frame[10] != ESV_GET:
+            return None
+        tid = frame[2:4]
+        seoj = frame[4:7]
+        deoj = frame[7:10]
+        opc = frame[11]
+        props = []
+        ok = True
+        pos = 12
+        for _ in range(opc):
+            epc = frame[pos]
+            pos += 2 + frame[pos + 1]
+            v = self.property(deoj, epc)
+            if v is None:
+                ok = False
+                props.append(bytes([epc, 0]))
+            else:
+                props.append(bytes([epc, len(v)]) + v)
+        esv = ESV_GET_RES if ok else ESV_GET_SNA
+        src = deoj if deoj[2] != 0 else deoj[:2] + bytes([self.args.instance])
+        return b"\x10\x81" + tid + src + seoj + bytes([esv, opc]) + b"".join(props)
+
+
+class Emulator:
+    def __init__(self, fd, args):
+        self.fd = fd
+        self.args = args
+        self.meter = Meter(args)
+        self.stats = Stats(args.gap)
+        self.buf = b""
+        self.timers = []
+        self.seq = itertools.count()
+        self.session = 0
+        self.reset()
+
+    def reset(self):
+        self.regs = dict(DEFAULT_REGS)
+        if self.args.session_lifetime > 0:
+            # S16 reports the PANA session lifetime the meter will enforce
+            self.regs[0x16] = f"{max(1, round(self.scaled(self.args.session_lifetime))):08X}"
+        self.ascii = False
+        self.joined = False
+        self.rate_limited = False
+        self.outage = False
+
+    def scaled(self, sec):
+        return sec / self.args.time_scale
+
+    def at(self, delay, fn, *a):
+        heapq.heappush(self.timers, (time.monotonic() + delay, next(self.seq), fn, a))
+
+    def out(self, line):
+        if self.args.verbose:
+            print(f"<- {line}", file=sys.stderr)
+        os.write(self.fd, line.encode() + b"\r\n")
+
+    def event(self, num, *params):
+        self.out(" ".join([f"EVENT {num:02X}", *params]))
+
+    # fault schedules
+
+    def schedule_faults(self):
+        a = self.args
+        if a.garbage > 0:
+            self.at(random.expovariate(a.garbage), self.garbage)
+        if a.rate_limit_every > 0:
+            self.at(self.scaled(a.rate_limit_every), self.rate_limit_on)
+        if a.outage_every > 0:
+            self.at(self.scaled(a.outage_every), self.outage_on)
+
+    def garbage(self):
+        n = random.randint(1, 40)
+        line = "".join(random.choice("0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ :") for _ in range(n))
+        self.out(line)
+        self.at(random.expovariate(self.args.garbage), self.garbage)
+
+    def rate_limit_on(self):
+        if self.joined:
+            self.rate_limited = True
+            self.event(0x32)
+        self.at(self.scaled(self.args.rate_limit_duration), self.rate_limit_off)
+
+    def rate_limit_off(self):
+        if self.rate_limited:
+            self.rate_limited = False
+            self.event(0x33)
+        self.at(self.scaled(self.args.rate_limit_every), self.rate_limit_on)
+
+    def outage_on(self):
+        print("outage start", file=sys.stderr)
+        self.outage = True
+        self.at(self.scaled(self.args.outage_duration), self.outage_off)
+
+    def outage_off(self):
+        print("outage end", file=sys.stderr)
+        self.outage = False
+        self.at(self.scaled(self.args.outage_every), self.outage_on)
+
+    def session_expire(self, generation):
+        if not self.joined or generation != self.session:
+            return
+        self.joined = False
+        self.event(0x29, METER_IP)
+        # module re-authenticates automatically
+        self.at(self.scaled(2), self.join_done, True)
+
+    def join_done(self, expected_success):
+        if self.outage or not expected_success or random.random() < self.args.join_fail:
+            self.event(0x24, METER_IP)
+            return
+        self.joined = True
+        self.session += 1
+        self.event(0x25, METER_IP)
+        if self.args.session_lifetime > 0:
+            self.at(self.scaled(self.args.session_lifetime), self.session_expire, self.session)
+
+    # commands
+
+    def scan_done(self):
+        if not self.outage:
+            self.event(0x20, METER_MAC)
+            self.out("EPANDESC")
+            for line in [
+                f"Channel:{METER_CHANNEL}",
+                "Channel Page:09",
+                f"Pan ID:{METER_PANID}",
+                f"Addr:{METER_MAC}",
+                f"LQI:{self.args.lqi:02X}",
+                "PairID:00000000",
+            ]:
+                self.out("  " + line)
+        self.event(0x22, OWN_IP)
+
+    def command(self, line):
+        if self.args.verbose:
+            print(f"-> {line}", file=sys.stderr)
+        if self.regs[0xFE] == "1":
+            self.out(line)
+        words = line.split()
+        if not words:
+            return
+        cmd, params = words[0], words[1:]
+        if cmd == "SKVER":
+            self.out("EVER 1.2.10")
+        elif cmd == "SKINFO":
+            self.out(f"EINFO {OWN_IP} 001D129000000001 {self.regs[0x02]} {self.regs[0x03]} FFFE")
+        elif cmd == "SKSREG" and params:
+            reg = int(params[0][1:], 16)
+            if len(params) == 1:
+                self.out(f"ESREG {self.regs.get(reg, '0')}")
+            else:
+                self.regs[reg] = params[1]
+        elif cmd == "ROPT":
+            os.write(self.fd, b"OK 01\r" if self.ascii else b"OK 00\r")
+            return
+        elif cmd == "WOPT":
+            self.ascii = params[:1] == ["01"]
+            os.write(self.fd, b"OK\r")
+            return
+        elif cmd in ("SKSETPWD", "SKSETRBID"):
+            pass
+        elif cmd == "SKSCAN":
+            self.at(self.scaled(self.args.scan_time), self.scan_done)
+        elif cmd == "SKLL64" and params:
+            self.out(mac_to_ipv6(params[0]))
+            return
+        elif cmd in ("SKJOIN", "SKREJOIN"):
+            ok = self.regs[0x02] == METER_CHANNEL and self.regs[0x03] == METER_PANID
+            self.at(self.scaled(2), self.join_done, ok)
+        elif cmd == "SKTERM":
+            self.joined = False
+            self.at(0.1, self.event, 0x27, METER_IP)
+        elif cmd == "SKRESET":
+            self.reset()
+        else:
+            self.out("FAIL ER04")
+            return
+        self.out("OK")
+
+    def sendto(self, frame):
+        self.stats.requests += 1
+        self.out("OK")
+        if not self.joined or self.rate_limited:
+            self.stats.send_failed += 1
+            self.at(0.05, self.event, 0x21, METER_IP, "01")
+            return
+        self.at(0.05, self.event, 0x21, METER_IP, "00")
+        if self.outage or random.random() < self.args.loss:
+            self.stats.dropped += 1
+            return
+        res = self.meter.handle(frame)
+        if res is None:
+            return
+        latency = self.args.latency / 1000 + random.uniform(0, self.args.jitter / 1000)
+        self.at(latency, self.rxudp, res)
+
+    def rxudp(self, data):
+        if not self.joined:
+            return
+        self.stats.answer(time.monotonic())
+        port = f"{EL_PORT:04X}"
+        self.out(f"ERXUDP {METER_IP} {OWN_IP} {port} {port} {METER_MAC} 1 {len(data):04X} {data.hex().upper()}")
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            if self.buf.startswith(b"SKSENDTO "):
+                fields = self.buf.split(b" ", 6)
+                if len(fields) < 7:
+                    return
+                length = int(fields[5], 16)
+                if len(fields[6]) < length:
+                    return
+                if self.regs[0xFE] == "1":
+                    self.out(b" ".join(fields[:6]).decode())
+                self.sendto(fields[6][:length])
+                self.buf = fields[6][length:]
+                continue
+            pos = self.buf.find(b"\r")
+            if pos < 0:
+                return
+            line = self.buf[:pos].decode(errors="replace").strip("\n")
+            self.buf = self.buf[pos + 1 :].lstrip(b"\n")
+            self.command(line)
+
+    def run(self):
+        self.schedule_faults()
+        next_report = time.monotonic() + self.args.report
+        while True:
+            now = time.monotonic()
+            while self.timers and self.timers[0][0] <= now:
+                _, _, fn, a = heapq.heappop(self.timers)
+                fn(*a)
+            if now >= next_report:
+                print(self.stats.report(), file=sys.stderr)
+                next_report = now + self.args.report
+            timeout = min(next_report, self.timers[0][0] if self.timers else next_report) - now
+            r, _, _ = select.select([self.fd], [], [], max(0, timeout))
+            if r:
+                self.feed(os.read(self.fd, 1024))
+
+
+BAUDS = {9600: termios.B9600, 19200: termios.B19200, 38400: termios.B38400, 57600: termios.B57600, 115200: termios.B115200}
+
+
+def open_port(args):
+    if args.device:
+        fd = os.open(args.device, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(fd)
+        attr = termios.tcgetattr(fd)
+        attr[4] = attr[5] = BAUDS[args.baud]
+        termios.tcsetattr(fd, termios.TCSANOW, attr)
+        return fd
+    master, slave = os.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    print(f"pty: {os.ttyname(slave)}", file=sys.stderr)
+    return master
+
+
+def main():
+    p = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    p.add_argument("--device", help="serial device connected to the ESP UART (default: create a pty)")
+    p.add_argument("--baud", type=int, default=115200, choices=sorted(BAUDS))
+    p.add_argument("--loss", type=float, default=0.0, help="probability a Get request gets no response")
+    p.add_argument("--latency", type=float, default=300, help="response latency in ms")
+    p.add_argument("--jitter", type=float, default=200, help="additional random latency in ms")
+    p.add_argument("--join-fail", type=float, default=0.0, help="probability a join fails (EVENT 24)")
+    p.add_argument("--session-lifetime", type=float, default=0, help="seconds until EVENT 29, 0 to disable")
+    p.add_argument("--rate-limit-every", type=float, default=0, help="seconds between EVENT 32, 0 to disable")
+    p.add_argument("--rate-limit-duration", type=float, default=60, help="seconds until EVENT 33")
+    p.add_argument("--outage-every", type=float, default=0, help="seconds between radio outages, 0 to disable")
+    p.add_argument("--outage-duration", type=float, default=180, help="outage length in seconds")
+    p.add_argument("--garbage", type=float, default=0.0, help="garbage lines per second")
+    p.add_argument("--scan-time", type=float, default=6, help="active scan duration in seconds")
+    p.add_argument("--lqi", type=lambda v: int(v, 0), default=0xE1, help="LQI reported in EPANDESC")
+    p.add_argument("--instance", type=lambda v: int(v, 0), default=1, help="smart meter EOJ instance code")
+    p.add_argument("--initial-energy", type=int, default=12345, help="initial 0xE0 counter value")
+    p.add_argument("--time-scale", type=float, default=1.0, help="divide fault intervals by this factor")
+    p.add_argument("--gap", type=float, default=60, help="data gap (s) counted as an outage for MTTR")
+    p.add_argument("--report", type=float, default=600, help="stats report interval in seconds")
+    p.add_argument("-v", "--verbose", action="store_true")
+    args = p.parse_args()
+    emu = Emulator(open_port(args), args)
+    try:
+        emu.run()
+    except KeyboardInterrupt:
+        pass
+    print(emu.stats.report(), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
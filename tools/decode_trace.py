@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Decode the binary trace dumped by the b_route.dump_trace action.
+
+Reads an ESPHome log (file or stdin), finds the lines between
+"trace begin" and "trace end" and prints one line per entry:
+
+    esphome logs device.yaml | tools/decode_trace.py
+    tools/decode_trace.py device.log
+
+Times are shown relative to the dump (negative = seconds before it).
+Entry layout and codes follow components/b_route/trace.h.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+ENTRY = struct.Struct("<IHHBBBB")  # time, tid, value, kind, state, code, aux
+
+KINDS = {1: "event", 2: "tx", 3: "rx", 4: "rx_drop", 5: "timeout", 6: "state"}
+STATES = [
+    "init",
+    "wait_ver",
+    "setting_values",
+    "scanning",
+    "joining",
+    "running",
+    "reauth",
+    "addr_conv",
+    "resetting",
+    "restarting",
+]
+EVENT_TYPES = ["none", "error", "ver", "rxudp", "pandesc", "info", "sreg", "event", "ok", "unknown"]
+EVENT_NUMS = {
+    0x01: "rcvNS",
+    0x02: "rcvNA",
+    0x05: "recvECHO",
+    0x1F: "doneEDscan",
+    0x20: "recvBCN",
+    0x21: "sentUDP",
+    0x22: "doneAScan",
+    0x24: "failedPANAconn",
+    0x25: "donePANAconn",
+    0x26: "recvDISC",
+    0x27: "donePANAdisc",
+    0x28: "timeoutPANDdisc",
+    0x29: "expiredSession",
+    0x32: "limitRate",
+    0x33: "canceledLimit",
+}
+DROPS = {1: "malformed", 2: "port", 3: "header", 4: "seoj", 5: "esv", 6: "properties"}
+ESVS = {0x52: "Get_SNA", 0x62: "Get", 0x72: "Get_Res", 0x73: "INF"}
+
+BEGIN = re.compile(r"trace begin (\d+) (\d+)/(\d+)")
+DATA = re.compile(r"trace ([0-9a-fA-F]+)")
+
+
+def name(table, v):
+    if isinstance(table, list):
+        return table[v] if v < len(table) else f"?{v}"
+    return table.get(v, f"0x{v:02X}")
+
+
+def describe(kind, code, aux, tid, value):
+    if kind == 1:
+        ev = name(EVENT_TYPES, code)
+        return f"{ev} {name(EVENT_NUMS, aux)}" if ev == "event" else ev
+    if kind == 2:
+        return f"epc={code:02X} n={aux} tid={tid}"
+    if kind == 3:
+        return f"epc={code:02X} {name(ESVS, aux)} opc={value} tid={tid}"
+    if kind == 4:
+        stage = name(DROPS, code)
+        if stage == "port":
+            return f"{stage} lport={value}"
+        return f"{stage} esv={aux:02X} tid={tid}" if code >= 4 else stage
+    if kind == 5:
+        return f"epc={code:02X} attempts={aux} tid={tid}"
+    if kind == 6:
+        return f"-> {name(STATES, code)}"
+    return f"code={code:02X} aux={aux:02X} tid={tid} value={value}"
+
+
+def decode(lines):
+    now = None
+    raw = b""
+    for line in lines:
+        if m := BEGIN.search(line):
+            now = int(m.group(1))
+            raw = b""
+            print(f"# {m.group(2)} entries ({m.group(3)} recorded since boot)")
+            continue
+        if now is None:
+            continue
+        if "trace end" in line:
+            for off in range(0, len(raw) - ENTRY.size + 1, ENTRY.size):
+                time, tid, value, kind, state, code, aux = ENTRY.unpack_from(raw, off)
+                dt = ((time - now + 2**31) % 2**32 - 2**31) / 1000
+                print(f"{dt:10.3f} {name(STATES, state):<14} {name(KINDS, kind):<8} {describe(kind, code, aux, tid, value)}")
+            now = None
+            continue
+        if m := DATA.search(line):
+            raw += bytes.fromhex(m.group(1))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"), default=sys.stdin, help="log file (default: stdin)")
+    args = parser.parse_args()
+    decode(args.log)
+
+
+if __name__ == "__main__":
+    main()